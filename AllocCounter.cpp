@@ -0,0 +1,86 @@
+//
+//  AllocCounter.cpp
+//  pirates_savegame_editor
+//
+// Each block gets a small header holding its size, so that delete knows how much live heap it gives back.
+// Only the plain and array forms of new are counted. Over-aligned new keeps the library's own version.
+
+#include "AllocCounter.hpp"
+
+#ifdef PIRATES_COUNT_ALLOCATIONS
+
+#include <atomic>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+using namespace std;
+
+namespace {
+struct PhaseCounters {
+    atomic<size_t> allocations{0};
+    atomic<size_t> bytes{0};
+    atomic<size_t> peak_live{0};   // The most live heap seen while this phase was allocating
+};
+}
+static PhaseCounters counters[PHASE_COUNT];
+static atomic<size_t> live_bytes{0};
+static atomic<size_t> peak_live_bytes{0};
+static thread_local alloc_phase current_phase = PHASE_OTHER;
+constexpr size_t header_size = alignof(max_align_t);
+
+static void raise_to(atomic<size_t> & peak, size_t value) {
+    size_t seen = peak.load(memory_order_relaxed);
+    while (value > seen && ! peak.compare_exchange_weak(seen, value, memory_order_relaxed)) {}
+}
+
+static void * counted_malloc(size_t size) {
+    auto block = (unsigned char *)malloc(size + header_size);
+    if (! block) return nullptr;
+    *(size_t *)block = size;
+    auto & phase = counters[current_phase];
+    phase.allocations.fetch_add(1, memory_order_relaxed);
+    phase.bytes.fetch_add(size, memory_order_relaxed);
+    size_t live = live_bytes.fetch_add(size, memory_order_relaxed) + size;
+    raise_to(phase.peak_live, live);
+    raise_to(peak_live_bytes, live);
+    return block + header_size;
+}
+
+static void counted_free(void * p) {
+    if (! p) return;
+    auto block = (unsigned char *)p - header_size;
+    live_bytes.fetch_sub(*(size_t *)block, memory_order_relaxed);
+    free(block);
+}
+
+void * operator new(size_t size) {
+    void * p = counted_malloc(size);
+    if (! p) throw bad_alloc();
+    return p;
+}
+void * operator new[](size_t size) { return operator new(size); }
+void * operator new(size_t size, const nothrow_t &) noexcept   { return counted_malloc(size); }
+void * operator new[](size_t size, const nothrow_t &) noexcept { return counted_malloc(size); }
+void operator delete(void * p) noexcept   { counted_free(p); }
+void operator delete[](void * p) noexcept { counted_free(p); }
+void operator delete(void * p, size_t) noexcept   { counted_free(p); }
+void operator delete[](void * p, size_t) noexcept { counted_free(p); }
+void operator delete(void * p, const nothrow_t &) noexcept   { counted_free(p); }
+void operator delete[](void * p, const nothrow_t &) noexcept { counted_free(p); }
+
+AllocScope::AllocScope(alloc_phase phase) : previous(current_phase) { current_phase = phase; }
+AllocScope::~AllocScope() { current_phase = previous; }
+
+void report_allocations() {
+    // Uses printf, so that the report itself does not allocate.
+    static const char * const names[PHASE_COUNT] = {"other", "setup", "decode", "translate", "format", "parse", "encode", "splice"};
+    printf("Heap allocations by phase\n");
+    printf("  %-10s %12s %14s %14s\n", "phase", "allocations", "bytes", "peak live");
+    for (int p=0; p<PHASE_COUNT; p++) {
+        printf("  %-10s %12zu %14zu %14zu\n", names[p], counters[p].allocations.load(), counters[p].bytes.load(), counters[p].peak_live.load());
+    }
+    printf("  Peak live heap %zu bytes, %zu still live\n", peak_live_bytes.load(), live_bytes.load());
+}
+
+#endif
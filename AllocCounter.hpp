@@ -0,0 +1,42 @@
+//
+//  AllocCounter.hpp
+//  pirates_savegame_editor
+//
+
+#ifndef AllocCounter_hpp
+#define AllocCounter_hpp
+
+// Heap allocation counting, for builds with PIRATES_COUNT_ALLOCATIONS defined.
+// Those builds replace the global operator new and delete to count allocations, bytes,
+// and the peak live heap, split up by the phase of the work that asked for the memory.
+// In a normal build, AllocScope is empty and report_allocations does nothing.
+
+enum alloc_phase : char { PHASE_OTHER, PHASE_SETUP, PHASE_DECODE, PHASE_TRANSLATE, PHASE_FORMAT, PHASE_PARSE, PHASE_ENCODE, PHASE_SPLICE, PHASE_COUNT };
+
+#ifdef PIRATES_COUNT_ALLOCATIONS
+
+// Allocations on this thread count toward phase until the scope ends. Scopes nest.
+class AllocScope {
+public:
+    explicit AllocScope(alloc_phase phase);
+    ~AllocScope();
+    AllocScope(const AllocScope &) = delete;
+    AllocScope & operator=(const AllocScope &) = delete;
+private:
+    alloc_phase previous;
+};
+
+void report_allocations();   // Prints a table of the counts, per phase.
+
+#else
+
+class AllocScope {
+public:
+    explicit AllocScope(alloc_phase) {}
+};
+
+inline void report_allocations() {}
+
+#endif
+
+#endif /* AllocCounter_hpp */
@@ -0,0 +1,290 @@
+//
+//  Benchmark.cpp
+//  pirates_savegame_editor
+//
+// Benchmarks for the whole operations (unpack, pack, splice, auto) and for the pieces inside them
+// (each rmeth codec, the map compressor, pst line parsing, the translations).
+// The corpus is generated from fixed seeds, so runs on different days and machines measure the same work.
+
+#include "Benchmark.hpp"
+#include "PiratesFiles.hpp"
+#include "PgGenerator.hpp"
+#include "PgImage.hpp"
+#include "PgOutput.hpp"
+#include "PstFile.hpp"
+#include "PstLine.hpp"
+#include "MapCodec.hpp"
+#include "HexCodec.hpp"
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "boost/filesystem.hpp"
+using namespace std;
+
+constexpr int corpus_size = 3;
+
+namespace {
+struct Benchmark {
+    string name;
+    string unit;                  // What items counts: bytes, lines, rows, or files.
+    function<size_t()> run;       // Does the work once, and returns the number of items processed.
+};
+
+// The scratch directory for the corpus, with its own name so that runs at the same time keep apart.
+// Also quiets cout while the routines run. However run_benchmarks ends, cout is put back and the directory removed.
+class BenchmarkScratch {
+public:
+    const string dir = (boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("pirates_benchmark-%%%%-%%%%")).string();
+    
+    BenchmarkScratch() { boost::filesystem::create_directories(dir); }
+    ~BenchmarkScratch() {
+        speak();
+        boost::system::error_code ec;
+        boost::filesystem::remove_all(dir, ec);
+    }
+    BenchmarkScratch(const BenchmarkScratch &) = delete;
+    BenchmarkScratch & operator=(const BenchmarkScratch &) = delete;
+    
+    void quiet() { real_cout = cout.rdbuf(chatter.rdbuf()); }
+    void speak() {
+        if (real_cout) { cout.rdbuf(real_cout); }
+        real_cout = nullptr;
+        chatter.str("");
+    }
+    
+private:
+    streambuf * real_cout = nullptr;
+    ostringstream chatter;
+};
+}
+
+static void report(const Benchmark & b, int iterations, vector<double> & ns, size_t items) {
+    sort(ns.begin(), ns.end());
+    double total = 0;
+    for (double t : ns) { total += t; }
+    double median = ns[ns.size()/2];
+    cout << fixed;
+    cout.precision(0);
+    cout << "{\"benchmark\":\"" << b.name << "\",\"warmup\":1,\"iterations\":" << iterations
+         << ",\"min_ns\":" << ns.front() << ",\"median_ns\":" << median << ",\"mean_ns\":" << total/ns.size()
+         << ",\"max_ns\":" << ns.back() << ",\"items\":" << items << ",\"unit\":\"" << b.unit << "\"";
+    cout.precision(1);
+    cout << ",\"items_per_s\":" << items / (median / 1e9) << "}" << endl;
+}
+
+static vector<Benchmark> micro_benchmarks(const vector<string> & images) {
+    vector<Benchmark> benchmarks;
+    
+    // Decode every line of the corpus once, so the encoders and translations have values to work with.
+    struct Decoded {
+        vector<PgImage> layouts;
+        vector<vector<PstLine>> lines;   // One vector of decoded lines per corpus file, in plan order.
+        vector<string> pst_lines;        // The unpacked text, one pst line at a time.
+    };
+    auto decoded = make_shared<Decoded>();
+    for (auto && image : images) {
+        decoded->layouts.emplace_back((const unsigned char *)image.data(), image.size());
+        vector<PstLine> lines;
+        lines.reserve(decode_plan.size());
+        for (size_t i=0; i<decode_plan.size(); i++) {
+            lines.push_back(decoded->layouts.back().read_line(decoded->layouts.back().field((int)i)));
+        }
+        decoded->lines.push_back(std::move(lines));
+        
+        PgReader reader((const unsigned char *)image.data(), image.size());
+        istringstream text(unpack_pst_text(reader, 1));
+        string line;
+        while (getline(text, line)) {
+            if (line[0] != '#') { decoded->pst_lines.push_back(line); }
+        }
+    }
+    
+    // One decoder and one encoder benchmark per rmeth, each over all of the lines of that rmeth.
+    for (int m=0; m<=ZERO; m++) {
+        rmeth method = (rmeth)m;
+        vector<size_t> plan_lines;
+        for (size_t i=0; i<decode_plan.size(); i++) {
+            if (decode_plan[i].method == method) { plan_lines.push_back(i); }
+        }
+        if (plan_lines.size() == 0) continue;
+        
+        // Each decode gets its own PstLine to decode into, made ahead of time like unpackPst does.
+        struct DecodeTarget { size_t file; size_t offset; PstLine line; size_t code_length; };
+        auto targets = make_shared<vector<DecodeTarget>>();
+        for (size_t f=0; f<images.size(); f++) {
+            for (size_t i : plan_lines) {
+                targets->push_back({f, decoded->layouts[f].field((int)i).offset, PstLine(decode_plan[i]), decode_plan[i].line_code.length()});
+            }
+        }
+        benchmarks.push_back({"decode_" + name_for_meth[m], "lines", [targets, &images]() {
+            vector<PstLine> features;
+            for (auto && target : *targets) {
+                PgReader in((const unsigned char *)images[target.file].data(), images[target.file].size(), target.offset);
+                features.clear();
+                target.line.line_code.resize(target.code_length);   // The map rows add _293 each time.
+                target.line.read_binary(in, features);
+            }
+            return targets->size();
+        }});
+        benchmarks.push_back({"encode_" + name_for_meth[m], "lines", [decoded, plan_lines]() {
+            size_t count = 0;
+            string buffer(4096, '\0');
+            for (auto && lines : decoded->lines) {
+                for (size_t i : plan_lines) {
+                    const PstLine & line = lines[i];
+                    if (line.binary_size() > buffer.size()) { buffer.resize(line.binary_size()); }
+                    line.encode_binary((unsigned char *)&buffer[0]);
+                    count++;
+                }
+            }
+            return count;
+        }});
+    }
+    
+    benchmarks.push_back({"map_compress", "rows", [decoded, &images]() {
+        size_t count = 0;
+        string hex(compressed_map_size(293), '0');
+        vector<int> feature_columns;
+        for (size_t f=0; f<images.size(); f++) {
+            for (size_t i=0; i<decode_plan.size(); i++) {
+                if (! is_world_map(decode_plan[i].method)) continue;
+                feature_columns.clear();
+                auto field = decoded->layouts[f].field((int)i);
+                compress_map_row((const unsigned char *)images[f].data() + field.offset, decode_plan[i].bytes,
+                                 decode_plan[i].method, &hex[0], feature_columns);
+                count++;
+            }
+        }
+        return count;
+    }});
+    benchmarks.push_back({"map_expand", "rows", [decoded]() {
+        size_t count = 0;
+        unsigned char row[293];
+        for (auto && lines : decoded->lines) {
+            for (size_t i=0; i<decode_plan.size(); i++) {
+                if (decode_plan[i].method == FMAP || decode_plan[i].method == CMAP) {
+                    expand_map_row(lines[i].value.data(), decode_plan[i].bytes, decode_plan[i].method, row);
+                    count++;
+                }
+            }
+        }
+        return count;
+    }});
+    benchmarks.push_back({"hex_codec", "bytes", [&images]() {
+        size_t total = 0;
+        string hex, bytes;
+        for (auto && image : images) {   // The images differ in size by the length of their TEXT lines.
+            hex.resize(2*image.size());
+            bytes.resize(image.size());
+            hex_encode((const unsigned char *)image.data(), image.size(), &hex[0]);
+            hex_decode(hex.data(), image.size(), (unsigned char *)&bytes[0]);
+            total += image.size();
+        }
+        return total;
+    }});
+    benchmarks.push_back({"parse_pst_line", "lines", [decoded]() {
+        PstTextLine parsed;
+        Sortcode total = 0;
+        for (auto && line : decoded->pst_lines) {
+            parse_pst_line(line, parsed);
+            total += index_to_sortcode(parsed.line_code);
+        }
+        return decoded->pst_lines.size() + (total == 0);   // Using total keeps the sortcodes from being optimized away.
+    }});
+    benchmarks.push_back({"translate", "lines", [decoded, &images]() {
+        size_t count = 0;
+        for (size_t f=0; f<images.size(); f++) {
+            DecodeContext ctx;
+            size_t personal_start = decoded->layouts[f].field(plan_index_for("Personal_0")).offset;
+            ctx.starting_year = read_starting_year(PgReader((const unsigned char *)images[f].data(), images[f].size()), personal_start);
+            for (auto && line : decoded->lines[f]) {
+                line.get_translation(ctx);
+                count++;
+            }
+        }
+        return count;
+    }});
+    return benchmarks;
+}
+
+static vector<Benchmark> end_to_end_benchmarks(const string & dir) {
+    // These run the same routines as the command line switches, on files in dir.
+    vector<Benchmark> benchmarks;
+    auto corpus = [dir](int n) { return dir + "/bench" + to_string(n); };
+    auto file_bytes = [corpus]() {
+        size_t total = 0;
+        for (int n=0; n<corpus_size; n++) { total += boost::filesystem::file_size(corpus(n) + "." + pg_suffix); }
+        return total;
+    };
+    benchmarks.push_back({"unpack", "bytes", [corpus, file_bytes]() {
+        for (int n=0; n<corpus_size; n++) { unpack(corpus(n)); }
+        return file_bytes();
+    }});
+    benchmarks.push_back({"pack", "bytes", [corpus, file_bytes]() {
+        for (int n=0; n<corpus_size; n++) { pack(corpus(n)); }
+        return file_bytes();
+    }});
+    benchmarks.push_back({"pack_pstfile", "bytes", [corpus, file_bytes]() {   // The slower path, for pst files that do not match the plan.
+        for (int n=0; n<corpus_size; n++) {
+            PstFile pst(corpus(n));
+            pst.write_pg();
+        }
+        return file_bytes();
+    }});
+    benchmarks.push_back({"test", "bytes", [corpus, file_bytes]() {
+        for (int n=0; n<corpus_size; n++) { test_roundtrip(corpus(n)); }
+        return file_bytes();
+    }});
+    benchmarks.push_back({"splice", "files", [corpus, dir]() {
+        splice(corpus(0), corpus(1), dir + "/out0," + dir + "/out1", "Ship_0,Log_x_10,City_3_x,CityName_4", "", "", "");
+        return (size_t)2;
+    }});
+    benchmarks.push_back({"auto_splice", "files", [corpus, dir]() {
+        auto_splice(corpus(0), corpus(1) + "," + corpus(2), dir + "/out0," + dir + "/out1", "");
+        return (size_t)2;
+    }});
+    return benchmarks;
+}
+
+void run_benchmarks(std::string filter, int iterations) {
+    if (iterations < 1) throw invalid_argument("-iterations must be at least 1");
+    
+    // The corpus is written to a scratch directory for the end to end benchmarks.
+    vector<string> images;
+    for (int n=0; n<corpus_size; n++) { images.push_back(generate_savegame(n+1)); }
+    BenchmarkScratch scratch;
+    const string & dir = scratch.dir;
+    // The routines print their progress, which is not wanted between the results.
+    scratch.quiet();
+    for (int n=0; n<corpus_size; n++) {
+        write_savegame(dir + "/bench" + to_string(n) + "." + pg_suffix, images[n]);
+        unpack(dir + "/bench" + to_string(n));   // Any benchmark can run alone, so the pst files are made here too.
+    }
+    for (int n=0; n<2; n++) {   // splice needs its output files to exist already.
+        write_savegame(dir + "/out" + to_string(n) + "." + pg_suffix, images[corpus_size-1]);
+    }
+    scratch.speak();
+    
+    auto benchmarks = micro_benchmarks(images);
+    auto more = end_to_end_benchmarks(dir);
+    benchmarks.insert(benchmarks.end(), more.begin(), more.end());
+    for (auto && b : benchmarks) {
+        if (filter != "all" && b.name.find(filter) == string::npos) continue;
+        vector<double> ns;
+        size_t items = 0;
+        for (int i=-1; i<iterations; i++) {   // i == -1 is the warmup.
+            scratch.quiet();
+            auto start = chrono::steady_clock::now();
+            items = b.run();
+            auto stop = chrono::steady_clock::now();
+            scratch.speak();
+            if (i >= 0) { ns.push_back(chrono::duration<double, nano>(stop - start).count()); }
+        }
+        report(b, iterations, ns, items);
+    }
+}
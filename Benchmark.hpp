@@ -0,0 +1,16 @@
+//
+//  Benchmark.hpp
+//  pirates_savegame_editor
+//
+
+#ifndef Benchmark_hpp
+#define Benchmark_hpp
+
+#include <string>
+
+// Runs the benchmarks whose names contain filter ("all" runs everything), over a fixed synthetic corpus.
+// Each benchmark has one warmup run and then the given number of timed runs.
+// Results are printed as one JSON object per line.
+void run_benchmarks(std::string filter, int iterations);
+
+#endif /* Benchmark_hpp */
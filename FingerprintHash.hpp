@@ -0,0 +1,22 @@
+//
+//  FingerprintHash.hpp
+//  pirates_savegame_editor
+//
+
+#ifndef FingerprintHash_hpp
+#define FingerprintHash_hpp
+
+#include <cstddef>
+#include <cstdint>
+
+// FNV-1a over a block of bytes. Not for security, only to notice that bytes have changed:
+// a savegame since the last -sweep, or a journal that was not completely written.
+inline uint64_t fingerprint_hash(const unsigned char * data, size_t size) {
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i=0; i<size; i++) {
+        hash = (hash ^ data[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+#endif /* FingerprintHash_hpp */
@@ -0,0 +1,117 @@
+//
+//  HexCodec.cpp
+//  pirates_savegame_editor
+//
+// TopoMap alone is 462 lines of 586 bytes, and the world maps go through hex when they are packed,
+// so the hex conversion is worth doing 16 or 32 bytes at a time.
+
+#include "HexCodec.hpp"
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+static constexpr char hexchar_for_int[] = "0123456789abcdef";
+
+// 0-15 for hex digits, 0xff for anything else.
+struct HexTable {
+    unsigned char value[256];
+    constexpr HexTable() : value() {
+        for (int i=0; i<256; i++) { value[i] = 0xff; }
+        for (int i=0; i<10; i++) { value['0'+i] = i; }
+        for (int i=0; i<6; i++)  { value['a'+i] = 10+i; value['A'+i] = 10+i; }
+    }
+};
+static constexpr HexTable hex_table;
+
+static void hex_encode_scalar(const unsigned char * in, size_t count, char * out) {
+    for (size_t i=0; i<count; i++) {
+        out[2*i]   = hexchar_for_int[in[i] >> 4];
+        out[2*i+1] = hexchar_for_int[in[i] & 0x0F];
+    }
+}
+
+static bool hex_decode_scalar(const char * in, size_t count, unsigned char * out) {
+    unsigned char bad = 0;
+    for (size_t i=0; i<count; i++) {
+        unsigned char hi = hex_table.value[(unsigned char)in[2*i]];
+        unsigned char lo = hex_table.value[(unsigned char)in[2*i+1]];
+        bad |= (hi | lo) & 0xf0;
+        out[i] = (unsigned char)(hi << 4 | (lo & 0x0f));
+    }
+    return bad == 0;
+}
+
+#if defined(__SSE2__)
+static inline __m128i nibbles_to_hexchars(__m128i n) {
+    // '0'+n for 0-9, 'a'+n-10 for 10-15.
+    __m128i letters = _mm_and_si128(_mm_cmpgt_epi8(n, _mm_set1_epi8(9)), _mm_set1_epi8('a' - '0' - 10));
+    return _mm_add_epi8(_mm_add_epi8(n, _mm_set1_epi8('0')), letters);
+}
+
+static inline __m128i in_range(__m128i c, char lo, char hi) {
+    return _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8(lo - 1)), _mm_cmplt_epi8(c, _mm_set1_epi8(hi + 1)));
+}
+
+static inline __m128i hexchars_to_nibbles(__m128i c, __m128i & valid) {
+    __m128i digit = in_range(c, '0', '9');
+    __m128i lower = in_range(c, 'a', 'f');
+    __m128i upper = in_range(c, 'A', 'F');
+    valid = _mm_and_si128(valid, _mm_or_si128(digit, _mm_or_si128(lower, upper)));
+    __m128i n = _mm_and_si128(digit, _mm_sub_epi8(c, _mm_set1_epi8('0')));
+    n = _mm_or_si128(n, _mm_and_si128(lower, _mm_sub_epi8(c, _mm_set1_epi8('a' - 10))));
+    n = _mm_or_si128(n, _mm_and_si128(upper, _mm_sub_epi8(c, _mm_set1_epi8('A' - 10))));
+    return n;
+}
+
+static inline __m128i pack_nibble_pairs(__m128i n) {
+    // Each 16 bit lane holds the high nibble in its low byte, and the low nibble in its high byte.
+    __m128i hi = _mm_slli_epi16(_mm_and_si128(n, _mm_set1_epi16(0x00ff)), 4);
+    __m128i lo = _mm_srli_epi16(n, 8);
+    return _mm_or_si128(hi, lo);   // 8 bytes, one per 16 bit lane.
+}
+#endif
+
+void hex_encode(const unsigned char * in, size_t count, char * out) {
+    size_t i = 0;
+#if defined(__AVX2__)
+    const __m256i low_nibble = _mm256_set1_epi8(0x0f);
+    for (; i + 32 <= count; i += 32) {
+        __m256i v  = _mm256_loadu_si256((const __m256i *)(in + i));
+        __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), low_nibble);
+        __m256i lo = _mm256_and_si256(v, low_nibble);
+        __m256i letters_hi = _mm256_and_si256(_mm256_cmpgt_epi8(hi, _mm256_set1_epi8(9)), _mm256_set1_epi8('a' - '0' - 10));
+        __m256i letters_lo = _mm256_and_si256(_mm256_cmpgt_epi8(lo, _mm256_set1_epi8(9)), _mm256_set1_epi8('a' - '0' - 10));
+        hi = _mm256_add_epi8(_mm256_add_epi8(hi, _mm256_set1_epi8('0')), letters_hi);
+        lo = _mm256_add_epi8(_mm256_add_epi8(lo, _mm256_set1_epi8('0')), letters_lo);
+        // The unpacks work within each 128 bit lane, so put the lanes back in order afterwards.
+        __m256i a = _mm256_unpacklo_epi8(hi, lo);
+        __m256i b = _mm256_unpackhi_epi8(hi, lo);
+        _mm256_storeu_si256((__m256i *)(out + 2*i),      _mm256_permute2x128_si256(a, b, 0x20));
+        _mm256_storeu_si256((__m256i *)(out + 2*i + 32), _mm256_permute2x128_si256(a, b, 0x31));
+    }
+#endif
+#if defined(__SSE2__)
+    for (; i + 16 <= count; i += 16) {
+        __m128i v  = _mm_loadu_si128((const __m128i *)(in + i));
+        __m128i hi = nibbles_to_hexchars(_mm_and_si128(_mm_srli_epi16(v, 4), _mm_set1_epi8(0x0f)));
+        __m128i lo = nibbles_to_hexchars(_mm_and_si128(v, _mm_set1_epi8(0x0f)));
+        _mm_storeu_si128((__m128i *)(out + 2*i),      _mm_unpacklo_epi8(hi, lo));
+        _mm_storeu_si128((__m128i *)(out + 2*i + 16), _mm_unpackhi_epi8(hi, lo));
+    }
+#endif
+    hex_encode_scalar(in + i, count - i, out + 2*i);
+}
+
+bool hex_decode(const char * in, size_t count, unsigned char * out) {
+    size_t i = 0;
+#if defined(__SSE2__)
+    __m128i valid = _mm_set1_epi8(-1);
+    for (; i + 16 <= count; i += 16) {
+        __m128i n0 = hexchars_to_nibbles(_mm_loadu_si128((const __m128i *)(in + 2*i)), valid);
+        __m128i n1 = hexchars_to_nibbles(_mm_loadu_si128((const __m128i *)(in + 2*i + 16)), valid);
+        _mm_storeu_si128((__m128i *)(out + i), _mm_packus_epi16(pack_nibble_pairs(n0), pack_nibble_pairs(n1)));
+    }
+    if (_mm_movemask_epi8(valid) != 0xffff) { return false; }
+#endif
+    return hex_decode_scalar(in + 2*i, count - i, out + i);
+}
@@ -0,0 +1,21 @@
+//
+//  HexCodec.hpp
+//  pirates_savegame_editor
+//
+
+#ifndef HexCodec_hpp
+#define HexCodec_hpp
+
+#include <cstddef>
+
+// Conversion between bytes and the lowercase hex used for BULK lines and the expanded world maps.
+// Uses AVX2 or SSE2 when the compiler targets them, with a scalar version for everything else.
+
+// Writes 2*count lowercase hex characters for count bytes.
+void hex_encode(const unsigned char * in, size_t count, char * out);
+
+// Reads 2*count hex characters (either case) into count bytes.
+// Returns false if any of the characters is not a hex digit.
+bool hex_decode(const char * in, size_t count, unsigned char * out);
+
+#endif /* HexCodec_hpp */
@@ -0,0 +1,36 @@
+//
+//  MapCodec.hpp
+//  pirates_savegame_editor
+//
+
+#ifndef MapCodec_hpp
+#define MapCodec_hpp
+
+#include <vector>
+#include "RMeth.hpp"
+
+// The world maps (FMAP, SMAP, CMAP) are stored one byte per square. Almost all squares are sea or land,
+// so the pst file shows one bit per square (as one hex character per 4 squares),
+// and lists everything else separately as a FEATURE line.
+
+struct MapBytes {
+    unsigned char sea;
+    unsigned char land;
+    unsigned char max_sea;   // Anything above this is shown as land in the compressed map.
+};
+constexpr MapBytes map_bytes_for(rmeth m) {
+    return m==CMAP ? MapBytes{0, 9, 4} : MapBytes{0, 0xff, 0};
+}
+
+// Number of hex characters in the compressed form of a row of bytes.
+constexpr int compressed_map_size(int bytes) { return bytes/4 + 1; }
+
+// Compresses a row into compressed_map_size(bytes) hex characters,
+// and fills feature_columns with the columns that are neither sea nor land.
+void compress_map_row(const unsigned char * row, int bytes, rmeth method, char * hex_out, std::vector<int> & feature_columns);
+
+// The reverse: expands the hex characters into sea and land bytes. The features have to be put back separately.
+// Returns false if the compressed map has a character that is not a hex digit.
+bool expand_map_row(const char * hex, int bytes, rmeth method, unsigned char * row_out);
+
+#endif /* MapCodec_hpp */
@@ -0,0 +1,113 @@
+//
+//  PgGenerator.cpp
+//  pirates_savegame_editor
+//
+// Synthetic savegames give repeatable test and benchmark inputs without needing real saves from a game install.
+// Values lean towards the edges (0, -1, the largest and smallest numbers) where encoders and decoders tend to disagree.
+
+#include "PgGenerator.hpp"
+#include "PstSection.hpp"
+#include "MapCodec.hpp"
+#include <random>
+#include <string>
+#include <vector>
+#include <limits>
+#include <unordered_map>
+using namespace std;
+
+// A few lines are used as indexes by their translations, so they only get values that the game uses.
+static const unordered_map<string, vector<int>> legal_values = {
+    {"Ship_x_0_0", {-1, 0, 1, 5, 12, 20, 26}},   // Ship Type
+    {"Ship_x_0_2", {-1, 0, 1, 2, 3, 4, 5, 9}},    // Flag
+};
+
+static void put_le(string & out, uint32_t n, int bytes) {
+    for (int b=0; b<bytes; b++) { out.push_back((char)(n >> (8*b))); }
+}
+
+static uint32_t edgy_number(mt19937_64 & rng, int bytes) {
+    // Mostly small numbers, with the extremes of a signed and unsigned number of this size mixed in.
+    uint32_t all_bits = bytes >= 4 ? 0xffffffffu : (1u << (8*bytes)) - 1;
+    uint32_t sign_bit = 1u << (8*bytes - 1);
+    switch (rng() % 8) {
+        case 0:  return 0;
+        case 1:  return all_bits;          // -1
+        case 2:  return sign_bit;          // Most negative
+        case 3:  return sign_bit - 1;      // Most positive
+        case 4:
+        case 5:  return rng() % 13;
+        default: return (uint32_t)rng() & all_bits;
+    }
+}
+
+static string random_text(mt19937_64 & rng) {
+    // The pst file trims spaces from the ends of a value, and cannot hold an empty one, so neither is generated.
+    static const string letters = "abcdefghijKLMNOPQRST '-.";
+    size_t length = 1 + rng() % 20;
+    string text;
+    for (size_t i=0; i<length; i++) { text.push_back(letters[rng() % letters.length()]); }
+    if (text.front() == ' ') text.front() = 'a';
+    if (text.back() == ' ')  text.back()  = 'z';
+    return text;
+}
+
+static void generate_map_row(mt19937_64 & rng, rmeth method, int bytes, string & out) {
+    MapBytes mb = map_bytes_for(method);
+    for (int i=0; i<bytes; i++) {
+        unsigned r = rng() % 100;
+        unsigned char b;
+        if (method == SMAP) {
+            b = r < 97 ? mb.sea : 1 + rng() % 254;
+        } else if (r < 50) {
+            b = mb.sea;
+        } else if (r < 97) {
+            b = mb.land;
+        } else {
+            do { b = (unsigned char)rng(); } while (b == mb.sea || b == mb.land);   // A feature
+        }
+        out.push_back((char)b);
+    }
+}
+
+std::string generate_savegame(uint64_t seed) {
+    mt19937_64 rng(seed);
+    string out;
+    out.reserve(1'100'000);
+    for (auto && line : decode_plan) {
+        const vector<int> * legal = nullptr;
+        for (auto && alias : line.lca) {
+            auto found = legal_values.find(alias);
+            if (found != legal_values.end()) { legal = &found->second; }
+        }
+        if (legal) {
+            put_le(out, (uint32_t)(*legal)[rng() % legal->size()], line.bytes);
+            continue;
+        }
+        switch (line.method) {
+            case TEXT: {
+                string text = random_text(rng);
+                put_le(out, (uint32_t)text.length(), 4);
+                out += text;
+                out.append(line.bytes, '\0');
+                break;
+            }
+            case ZERO:
+                out.append(line.bytes, '\0');
+                break;
+            case FMAP:
+            case SMAP:
+            case CMAP:
+                generate_map_row(rng, line.method, line.bytes, out);
+                break;
+            case mFLOAT:   // Map coordinates, which are never negative.
+                put_le(out, (uint32_t)(rng() % 600'000), 4);
+                break;
+            case BULK:
+                for (int b=0; b<line.bytes; b++) { out.push_back((char)edgy_number(rng, 1)); }
+                break;
+            default:
+                put_le(out, edgy_number(rng, line.bytes), line.bytes);
+        }
+    }
+    return out;
+}
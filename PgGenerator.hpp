@@ -0,0 +1,16 @@
+//
+//  PgGenerator.hpp
+//  pirates_savegame_editor
+//
+
+#ifndef PgGenerator_hpp
+#define PgGenerator_hpp
+
+#include <string>
+#include <cstdint>
+
+// Builds a synthetic savegame that follows the decode plan, with random but legal values for each rmeth.
+// The same seed always gives the same savegame.
+std::string generate_savegame(uint64_t seed);
+
+#endif /* PgGenerator_hpp */
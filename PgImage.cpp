@@ -0,0 +1,260 @@
+//
+//  PgImage.cpp
+//  pirates_savegame_editor
+//
+// The decode plan knows the size of every line except for TEXT, whose length is stored just before the string.
+// So the offsets are fixed until the first TEXT line in Intro, and then shift by the length of each string
+// in Intro, CityName and ShipName. Building the index takes one walk down the plan, reading only those lengths.
+// The same offsets let two savegames be compared a stretch of bytes at a time, 16 at a time where SSE2 is available.
+
+#include "PgImage.hpp"
+#include "PgReader.hpp"
+#include "PgOutput.hpp"
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <charconv>
+#include <cstdlib>
+#include <cctype>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+using namespace std;
+
+PgImage::PgImage(const std::string & pg_file) {
+    recover_savegame(pg_file);
+    PgInput input(pg_file);
+    image.assign((const char *)input.data(), input.size());
+    build_index();
+}
+
+PgImage::PgImage(const unsigned char * data, size_t size) : image((const char *)data, size) {
+    build_index();
+}
+
+void PgImage::build_index() {
+    constexpr int max_string_length = 1998;   // Same sanity check as PstLine::read_binary
+    PgReader in((const unsigned char *)image.data(), image.size());
+    offsets.resize(decode_plan.size()+1);
+    size_t offset = 0;
+    for (size_t i=0; i<decode_plan.size(); i++) {
+        offsets[i] = offset;
+        const PstPlanLine & plan_line = decode_plan[i];
+        if (plan_line.method == TEXT) {
+            int size_of_string = in.int_at(offset);
+            if (size_of_string < 0 || size_of_string > max_string_length)
+                throw runtime_error("Bad string length for " + plan_line.line_code + " at byte " + to_string(offset));
+            offset += 4 + size_of_string + plan_line.bytes;
+        } else {
+            offset += plan_line.bytes;
+        }
+    }
+    offsets.back() = offset;
+    if (offset != image.size())
+        throw runtime_error("Savegame is " + to_string(image.size()) + " bytes, but the layout needs " + to_string(offset));
+}
+
+PgField PgImage::field(int plan_index) const {
+    return {plan_index, &decode_plan.at(plan_index), offsets[plan_index], offsets[plan_index+1]-offsets[plan_index]};
+}
+
+static bool matches_pattern(const string & line_code, const string & pattern) {
+    // Compares one _ separated piece at a time. An x in the pattern matches any number.
+    size_t l = 0, p = 0;
+    while (p < pattern.length()) {
+        if (l >= line_code.length()) return false;
+        size_t l_end = min(line_code.find('_', l), line_code.length());
+        size_t p_end = min(pattern.find('_', p), pattern.length());
+        if (pattern.compare(p, p_end-p, "x") == 0 && l > 0) {
+            if (l_end == l || line_code.find_first_not_of("0123456789", l) < l_end) return false;
+        } else if (line_code.compare(l, l_end-l, pattern, p, p_end-p) != 0) {
+            return false;
+        }
+        l = l_end + 1;
+        p = p_end + 1;
+    }
+    return true;
+}
+
+PgField PgImage::field_at(size_t offset) const {
+    if (offset >= image.size()) throw out_of_range("No line at byte " + to_string(offset));
+    // Zero length lines share an offset with the next line, so take the last line that starts at or before offset.
+    auto after = upper_bound(offsets.begin(), offsets.end(), offset);
+    return field((int)(after - offsets.begin()) - 1);
+}
+
+std::vector<PgField> PgImage::fields(const std::string & line_code) const {
+    vector<PgField> result;
+    int i = plan_index_for(line_code);
+    if (i >= 0) {
+        result.push_back(field(i));
+        return result;
+    }
+    const vector<int> & alias = plan_indices_for_alias(line_code);
+    if (alias.size() > 0) {
+        for (int a : alias) {
+            result.push_back(field(a));
+        }
+        return result;
+    }
+    // Anything else takes a pass over the plan, staying within the section.
+    string section_name = line_code.substr(0, line_code.find('_'));
+    for (int s=0; s<section_vector.size(); s++) {
+        if (section_vector[s].name != section_name) continue;
+        for (auto p=decode_plan_sections[s]; p<decode_plan_sections[s+1]; p++) {
+            if (matches_pattern(decode_plan[p].line_code, line_code)) {
+                result.push_back(field((int)p));
+            }
+        }
+    }
+    return result;
+}
+
+static bool is_hex_digit(char c) { return isxdigit((unsigned char)c) != 0; }
+
+static void check_value(const PstPlanLine & plan_line, const std::string & value) {
+    // encode_binary trusts its value, as it comes from an unpacked pst file. A value typed for -set goes straight
+    // into the savegame, so it has to be a value that unpacking could have written, in the field's size.
+    constexpr int max_string_length = 1998;
+    const string & code = plan_line.line_code;
+    int bytes = plan_line.bytes;
+    auto whole_number = [&](long long low, long long high) {
+        long long n = 0;
+        auto result = from_chars(value.data(), value.data() + value.length(), n);
+        if (result.ec != errc() || result.ptr != value.data() + value.length() || value.empty())
+            throw invalid_argument("Not a whole number for " + code + ": " + value);
+        if (n < low || n > high)
+            throw invalid_argument("Out of range for " + code + ", which takes " + to_string(low) + " to " + to_string(high) + ": " + value);
+    };
+    auto decimal = [&](double scale, double low, double high) {
+        char * end = nullptr;
+        double d = value.empty() ? 0 : strtod(value.c_str(), &end);
+        if (value.empty() || end != value.c_str() + value.length() || isspace((unsigned char)value[0]))
+            throw invalid_argument("Not a number for " + code + ": " + value);
+        double scaled = d * scale + .5;
+        if (! (scaled >= low && scaled < high))
+            throw invalid_argument("Out of range for " + code + ": " + value);
+    };
+    long long bits = 8LL * bytes;
+    switch (plan_line.method) {
+        case TEXT:
+            if (value.length() > max_string_length) throw invalid_argument("Text is too long for " + code);
+            break;
+        case HEX:   // Like 0A.FF.00.12, one pair for each byte.
+            if (value.length() != 3*bytes-1) throw invalid_argument("Needs " + to_string(bytes) + " hex pairs separated by . for " + code + ": " + value);
+            for (size_t i=0; i<value.length(); i++) {
+                if (i % 3 == 2 ? value[i] != '.' : ! is_hex_digit(value[i]))
+                    throw invalid_argument("Needs " + to_string(bytes) + " hex pairs separated by . for " + code + ": " + value);
+            }
+            break;
+        case BULK:
+            if (value.length() != 2*bytes || ! all_of(value.begin(), value.end(), is_hex_digit))
+                throw invalid_argument("Needs " + to_string(2*bytes) + " hex digits for " + code + ": " + value);
+            break;
+        case INT:   // Held signed, but printed unsigned, so either is fine.
+            whole_number(-(1LL << (bits-1)), (1LL << bits) - 1);
+            break;
+        case SHORT:
+        case LCHAR:
+            whole_number(-(1LL << (bits-1)), (1LL << (bits-1)) - 1);
+            break;
+        case CHAR:
+            whole_number(0, (1LL << bits) - 1);
+            break;
+        case BINARY:
+            if (value.empty() || value.length() > bits || value.find_first_not_of("01") != string::npos)
+                throw invalid_argument("Needs up to " + to_string(bits) + " binary digits for " + code + ": " + value);
+            break;
+        case uFLOAT:
+            decimal(1000000, 0, double(1LL << bits));
+            break;
+        case mFLOAT:
+            decimal(1000, -double(1LL << (bits-1)), double(1LL << (bits-1)));
+            break;
+        case ZERO:
+            break;   // Always written as zeros.
+        default:
+            // A map row is only the sea and land, with the features listed separately, so setting it would lose the features.
+            throw invalid_argument("Cannot set a world map row directly, use -unpack and -pack: " + code);
+    }
+}
+
+void PgImage::write_value(const PgField & field, const std::string & value) {
+    const PstPlanLine & plan_line = *field.plan_line;
+    check_value(plan_line, value);
+    
+    PstLine line(plan_line);
+    line.value = value;
+    string binary(line.binary_size(), '\0');
+    line.encode_binary((unsigned char *)&binary[0]);
+    
+    // Only a TEXT field can change size, which moves everything after it.
+    image.replace(field.offset, field.size, binary);
+    if (binary.size() != field.size) { build_index(); }
+}
+
+PstLine PgImage::read_line(const PgField & field) const {
+    vector<PstLine> features;   // Only the map row itself is wanted.
+    return read_line(field, features);
+}
+
+PstLine PgImage::read_line(const PgField & field, std::vector<PstLine> & features) const {
+    PstLine line(*field.plan_line);
+    PgReader in((const unsigned char *)image.data(), image.size(), field.offset);
+    line.read_binary(in, features);
+    return line;
+}
+
+static size_t first_difference(const unsigned char * a, const unsigned char * b, size_t length) {
+    // Returns length if the bytes are all the same.
+    size_t i = 0;
+#if defined(__SSE2__)
+    // Nearly all of two savegames is the same, so skip ahead 64 bytes at a time until something differs.
+    for (; i + 64 <= length; i += 64) {
+        __m128i same = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(a + i)), _mm_loadu_si128((const __m128i *)(b + i)));
+        for (int k=16; k<64; k+=16) {
+            same = _mm_and_si128(same, _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(a + i + k)), _mm_loadu_si128((const __m128i *)(b + i + k))));
+        }
+        if (_mm_movemask_epi8(same) != 0xffff) break;
+    }
+    for (; i + 16 <= length; i += 16) {
+        unsigned int same = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(a + i)), _mm_loadu_si128((const __m128i *)(b + i))));
+        if (same != 0xffff) return i + __builtin_ctz(~same);
+    }
+#endif
+    for (; i < length; i++) {
+        if (a[i] != b[i]) return i;
+    }
+    return length;
+}
+
+std::vector<int> PgImage::differing_lines(const PgImage & other) const {
+    // Between TEXT lines of different lengths, the lines of the two images are the same sizes, so each stretch
+    // is compared as one block, and each difference is found in the offsets to know which line it is in.
+    vector<int> result;
+    auto a = (const unsigned char *)image.data();
+    auto b = (const unsigned char *)other.image.data();
+    auto same_size = [&](int i) { return offsets[i+1]-offsets[i] == other.offsets[i+1]-other.offsets[i]; };
+    int lines = (int)decode_plan.size();
+    int stretch_end = -1;
+    for (int i=0; i<lines; ) {
+        if (stretch_end < i) {
+            for (stretch_end = i; stretch_end < lines && same_size(stretch_end); stretch_end++) {}
+        }
+        size_t start = offsets[i];
+        size_t length = offsets[stretch_end] - start;
+        size_t d = first_difference(a + start, b + other.offsets[i], length);
+        if (d < length) {
+            // Zero length lines share an offset with the next line, so take the last line that starts at or before it.
+            auto after = upper_bound(offsets.begin() + i, offsets.begin() + stretch_end, start + d);
+            int line = (int)(after - offsets.begin()) - 1;
+            result.push_back(line);
+            i = line + 1;
+        } else {
+            if (stretch_end < lines) { result.push_back(stretch_end); }   // A TEXT line with a different length.
+            i = stretch_end + 1;
+        }
+    }
+    return result;
+}
@@ -0,0 +1,49 @@
+//
+//  PgImage.hpp
+//  pirates_savegame_editor
+//
+
+#ifndef PgImage_hpp
+#define PgImage_hpp
+
+#include <string>
+#include <vector>
+#include "PstSection.hpp"
+#include "PstLine.hpp"
+
+// Where one line of the pst file lives in the savegame.
+struct PgField {
+    int plan_index;                  // Index into decode_plan
+    const PstPlanLine * plan_line;   // line_code, rmeth and bytes
+    size_t offset;                   // Byte offset from the start of the savegame
+    size_t size;                     // Bytes in the savegame. For TEXT this counts the length int, the string, and the padding.
+};
+
+// PgImage holds the bytes of a savegame along with the offset of every line in the decode plan,
+// so that single fields can be found, read, or changed without unpacking the whole file.
+class PgImage {
+public:
+    explicit PgImage(const std::string & pg_file);
+    PgImage(const unsigned char * data, size_t size);
+    
+    PgField field(int plan_index) const;
+    PgField field_at(size_t offset) const;   // The line that holds the byte at offset.
+    // Takes a line_code like Ship_23_0_2 or a pattern in the style of -splice: _x is a wildcard number,
+    // and leaving off the end matches all of the extensions, so Ship_x_3 gives every Ship_N_3_M.
+    std::vector<PgField> fields(const std::string & line_code) const;
+    PstLine read_line(const PgField & field) const;                     // Decodes the one line, without its translation.
+    PstLine read_line(const PgField & field, std::vector<PstLine> & features) const;   // Also collects the features of a world map row.
+    void write_value(const PgField & field, const std::string & value); // Encodes the value with the line's rmeth and patches it in.
+    std::vector<int> differing_lines(const PgImage & other) const;      // Plan indices of the lines whose bytes are not the same in other.
+    
+    const std::string & bytes() const { return image; }
+    std::string & bytes() { return image; }
+    void reindex() { build_index(); }   // Needed after changing the length of a TEXT field.
+    
+private:
+    std::string image;
+    std::vector<size_t> offsets;   // One per line of decode_plan, plus the end.
+    void build_index();
+};
+
+#endif /* PgImage_hpp */
@@ -0,0 +1,223 @@
+//
+//  PgOutput.cpp
+//  pirates_savegame_editor
+//
+// Most edits change a tiny part of the savegame, so rewriting the whole file is wasted work.
+// An in-place write goes in three steps, each one synced to disk (along with the directory) before the next:
+//   1. The journal (pg_file.journal) gets the old bytes of every range that will change, a checksum, and an end marker.
+//   2. The changed ranges are written into pg_file.
+//   3. The journal is removed.
+// If the program stops during step 1, the journal has no end marker or a bad checksum, and pg_file was never touched.
+// If it stops during step 2, the journal is complete, and recover_savegame() puts the old bytes back.
+
+#include "PgOutput.hpp"
+#include "PgReader.hpp"
+#include "Trace.hpp"
+#include "FingerprintHash.hpp"
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <cstring>
+#include "boost/filesystem.hpp"
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#define PG_USE_PWRITE 1
+#endif
+using namespace std;
+
+static const string journal_start = "PGJOURNL";
+static const string journal_end   = "END.";
+
+static string journal_name(const string & pg_file) { return pg_file + ".journal"; }
+
+#ifdef PG_USE_PWRITE
+
+namespace {
+struct ChangedRange {
+    size_t offset;
+    size_t length;
+};
+}
+
+static void put_u64(string & out, uint64_t n) {
+    for (int b=0; b<8; b++) { out.push_back((char)(n >> (8*b))); }
+}
+
+static uint64_t get_u64(const unsigned char * b) {
+    uint64_t n = 0;
+    for (int i=7; i>=0; i--) { n = (n << 8) | b[i]; }
+    return n;
+}
+
+static void pwrite_all(int fd, const char * data, size_t length, size_t offset, const string & filename) {
+    while (length > 0) {
+        ssize_t done = pwrite(fd, data, length, (off_t)offset);
+        if (done < 0) throw runtime_error("Failed to write to " + filename + ": " + strerror(errno));
+        data += done;
+        length -= done;
+        offset += done;
+    }
+}
+
+static void write_synced(const string & filename, const string & data, int flags, const struct stat * like = nullptr) {
+    // With like, the file gets the same permissions and (where allowed) the same owner as that file.
+    int fd = open(filename.c_str(), flags, 0644);
+    if (fd < 0) throw runtime_error("Failed to write to " + filename + ": " + strerror(errno));
+    try {
+        if (like) {
+            if (fchmod(fd, like->st_mode & 07777) != 0) throw runtime_error("Failed to set permissions of " + filename + ": " + strerror(errno));
+            if (fchown(fd, like->st_uid, like->st_gid) != 0) {}   // Only the owner or root can give a file away, so keep ours.
+        }
+        pwrite_all(fd, data.data(), data.size(), 0, filename);
+        if (fsync(fd) != 0) throw runtime_error("Failed to sync " + filename);
+    } catch (...) {
+        close(fd);
+        throw;
+    }
+    close(fd);
+}
+
+static void sync_directory(const string & filename) {
+    // Creating, renaming or removing a file is only on disk once its directory is synced.
+    string dir = boost::filesystem::path(filename).parent_path().string();
+    if (dir.empty()) { dir = "."; }
+    int fd = open(dir.c_str(), O_RDONLY);
+    if (fd < 0) throw runtime_error("Failed to sync " + dir + ": " + strerror(errno));
+    bool synced = fsync(fd) == 0 || errno == EINVAL;   // Some file systems cannot sync a directory.
+    close(fd);
+    if (! synced) throw runtime_error("Failed to sync " + dir + ": " + strerror(errno));
+}
+
+static void write_whole_file(const string & pg_file, const string & image) {
+    // Write to the side and then swap it in, so pg_file is always either the old or the new savegame.
+    // A savegame that is being replaced keeps its permissions and owner.
+    string temp_file = pg_file + ".tmp";
+    struct stat original;
+    bool replacing = stat(pg_file.c_str(), &original) == 0;
+    write_synced(temp_file, image, O_WRONLY | O_CREAT | O_TRUNC, replacing ? &original : nullptr);
+    boost::filesystem::rename(temp_file, pg_file);
+    sync_directory(pg_file);
+}
+
+static vector<ChangedRange> find_changes(const unsigned char * old_bytes, const string & image) {
+    // Ranges that are close together are merged, since one write is cheaper than two small ones.
+    constexpr size_t merge_gap = 64;
+    vector<ChangedRange> changes;
+    const unsigned char * new_bytes = (const unsigned char *)image.data();
+    size_t size = image.size();
+    size_t i = 0;
+    while (i < size) {
+        // Skip equal bytes quickly, a block at a time.
+        while (i + 64 <= size && memcmp(old_bytes + i, new_bytes + i, 64) == 0) { i += 64; }
+        while (i < size && old_bytes[i] == new_bytes[i]) { i++; }
+        if (i == size) break;
+        size_t start = i;
+        size_t end = i + 1;   // One past the last changed byte.
+        for (i = end; i < size && i < end + merge_gap; i++) {
+            if (old_bytes[i] != new_bytes[i]) { end = i + 1; }
+        }
+        i = end;
+        changes.push_back({start, end - start});
+    }
+    return changes;
+}
+
+void recover_savegame(const std::string & pg_file) {
+    string journal_file = journal_name(pg_file);
+    if (! boost::filesystem::exists(journal_file)) return;
+    {
+        PgInput journal(journal_file);
+        const unsigned char * b = journal.data();
+        size_t size = journal.size();
+        // A journal is only used if it is all there: both markers, and the checksum of everything before it.
+        bool complete = size >= journal_start.size() + 8 + 8 + journal_end.size() &&
+            memcmp(b, journal_start.data(), journal_start.size()) == 0 &&
+            memcmp(b + size - journal_end.size(), journal_end.data(), journal_end.size()) == 0;
+        size_t stop = complete ? size - journal_end.size() - 8 : 0;   // Where the checksum starts.
+        complete = complete && get_u64(b + stop) == fingerprint_hash(b, stop);
+        if (complete) {
+            int fd = open(pg_file.c_str(), O_WRONLY);
+            if (fd < 0) throw runtime_error("Failed to roll back " + pg_file + " from " + journal_file);
+            size_t pos = journal_start.size() + 8;   // The file size is not needed to roll back.
+            while (pos + 16 <= stop) {
+                size_t offset = get_u64(b + pos);
+                size_t length = get_u64(b + pos + 8);
+                pos += 16;
+                if (pos + length > stop) break;
+                pwrite_all(fd, (const char *)b + pos, length, offset, pg_file);
+                pos += length;
+            }
+            bool synced = fsync(fd) == 0;
+            close(fd);
+            if (! synced) throw runtime_error("Failed to sync " + pg_file);   // Keep the journal until the old bytes are safe.
+        }
+    }
+    boost::filesystem::remove(journal_file);
+    sync_directory(journal_file);
+}
+
+void write_savegame(const std::string & pg_file, const std::string & image) {
+    TraceSpan span("write_savegame", pg_file);
+    recover_savegame(pg_file);
+    if (! boost::filesystem::exists(pg_file) || boost::filesystem::file_size(pg_file) != image.size()) {
+        write_whole_file(pg_file, image);
+        return;
+    }
+    
+    // Save the old bytes of each range that changes.
+    vector<ChangedRange> changes;
+    string journal = journal_start;
+    put_u64(journal, image.size());
+    {
+        PgInput old_file(pg_file);
+        changes = find_changes(old_file.data(), image);
+        if (changes.size() == 0) return;   // Nothing to do.
+        for (auto change : changes) {
+            put_u64(journal, change.offset);
+            put_u64(journal, change.length);
+            journal.append((const char *)old_file.data() + change.offset, change.length);
+        }
+    }
+    put_u64(journal, fingerprint_hash((const unsigned char *)journal.data(), journal.size()));
+    journal += journal_end;
+    string journal_file = journal_name(pg_file);
+    write_synced(journal_file, journal, O_WRONLY | O_CREAT | O_TRUNC);
+    sync_directory(journal_file);
+    
+    int fd = open(pg_file.c_str(), O_WRONLY);
+    if (fd < 0) throw runtime_error("Failed to write to " + pg_file + ": " + strerror(errno));
+    for (auto change : changes) {
+        pwrite_all(fd, image.data() + change.offset, change.length, change.offset, pg_file);
+    }
+    bool synced = fsync(fd) == 0;
+    close(fd);
+    if (! synced) throw runtime_error("Failed to sync " + pg_file);
+    boost::filesystem::remove(journal_file);
+    sync_directory(journal_file);
+}
+
+#else
+
+static void write_whole_file(const string & pg_file, const string & image) {
+    // Write to the side and then swap it in, so pg_file is always either the old or the new savegame.
+    string temp_file = pg_file + ".tmp";
+    auto outstream = ofstream(temp_file, ios::binary);
+    if (! outstream.is_open()) throw runtime_error("Failed to write to " + temp_file);
+    outstream.write(image.data(), image.size());
+    outstream.close();
+    if (! outstream) throw runtime_error("Failed to write to " + temp_file);
+    boost::filesystem::rename(temp_file, pg_file);
+}
+
+// Without pwrite, every write is a whole file write, so there is never a journal.
+void recover_savegame(const std::string & pg_file) {}
+
+void write_savegame(const std::string & pg_file, const std::string & image) {
+    TraceSpan span("write_savegame", pg_file);
+    write_whole_file(pg_file, image);
+}
+
+#endif
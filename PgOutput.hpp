@@ -0,0 +1,20 @@
+//
+//  PgOutput.hpp
+//  pirates_savegame_editor
+//
+
+#ifndef PgOutput_hpp
+#define PgOutput_hpp
+
+#include <string>
+
+// Writes a complete savegame image to pg_file. If the file is already there with the same size,
+// only the byte ranges that changed are written, in place, after saving the old bytes to a journal.
+// Otherwise (a new file, or a TEXT field that changed length) the image goes to a temporary file
+// which then replaces pg_file.
+void write_savegame(const std::string & pg_file, const std::string & image);
+
+// Puts back the old bytes from the journal of an in-place write that was interrupted, if there is one.
+void recover_savegame(const std::string & pg_file);
+
+#endif /* PgOutput_hpp */
@@ -0,0 +1,153 @@
+//
+//  PgPacker.cpp
+//  pirates_savegame_editor
+//
+// PstFile::write_pg sorts every line of the pst file into a tree before writing it out in order.
+// When the pst file matches the decode plan, every line already has a known place in the savegame,
+// so the packer just drops each value into its slot and encodes the slots into one buffer.
+// The buffer goes out through write_savegame, so repacking an existing savegame only writes the bytes that changed.
+
+#include "PgPacker.hpp"
+#include "PstFile.hpp"
+#include "PstSection.hpp"
+#include "PstLine.hpp"
+#include "HexCodec.hpp"
+#include "PgOutput.hpp"
+#include "PstStats.hpp"
+#include "Trace.hpp"
+#include "AllocCounter.hpp"
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <regex>
+#include <string>
+#include <vector>
+using namespace std;
+
+namespace {
+struct PackFeature {
+    int row;              // Index into decode_plan of the map row
+    int column;
+    unsigned char value;
+};
+}
+
+static bool read_feature(const PstTextLine & parsed, PackFeature & feature) {
+    // FeatureMap_35_202  : F1 : 10 : (Landmark)   edits column 202 of FeatureMap_35_293
+    Sortcode sortcode = index_to_sortcode(parsed.line_code);
+    int row = sortcode_get_index(sortcode,1);
+    int col = sortcode_get_index(sortcode,2);
+    if (parsed.line_code != "_" + to_string(row) + "_" + to_string(col)) return false;
+    
+    feature.row = plan_index_for(string(parsed.section) + "_" + to_string(row) + "_293");
+    if (feature.row < 0 || col >= decode_plan[feature.row].bytes) return false;
+    feature.column = col;
+    return parsed.value.length() == 2 && hex_decode(parsed.value.data(), 1, &feature.value);
+}
+
+bool pack_pst(const std::string & pst_file, const std::string & pg_file, FileStats * stats) {
+    TraceSpan span("pack_pst", pst_file);
+    auto instream = ifstream(pst_file);
+    if (! instream.is_open()) return false;   // Let PstFile report the problem.
+    string image;
+    if (! pack_pst_image(instream, image, stats)) return false;
+    instream.close();
+    
+    cout << "Reading " << regex_replace(pst_file, regex(".*\\/"), "") << "\n";
+    cout << "Writing " << regex_replace(pg_file, regex(".*\\/"), "") << "\n";
+    auto start = chrono::steady_clock::now();
+    write_savegame(pg_file, image);
+    if (stats) { stats->write_time += chrono::steady_clock::now() - start; }
+    return true;
+}
+
+static void count_packed(const vector<size_t> & offsets, const vector<PackFeature> & features, FileStats & stats) {
+    // Fills in the per section stats after packing, from where everything went.
+    // In -test, the same lines were already counted when they were unpacked, so only the bytes are added.
+    bool count_lines = stats.total().bytes_decoded == 0;
+    for (size_t s=0; s+1<decode_plan_sections.size(); s++) {
+        auto & section = stats.sections[s];
+        section.bytes_encoded += offsets[decode_plan_sections[s+1]] - offsets[decode_plan_sections[s]];
+        if (! count_lines) continue;
+        for (auto i=decode_plan_sections[s]; i<decode_plan_sections[s+1]; i++) {
+            section.lines[decode_plan[i].method]++;
+        }
+    }
+    if (! count_lines) return;
+    for (auto && feature : features) {
+        auto & section = stats.sections[decode_plan[feature.row].section];
+        section.lines[FEATURE]++;
+        section.features++;
+    }
+}
+
+bool pack_pst_image(std::istream & instream, std::string & image, FileStats * stats) {
+    TraceSpan span("pack_pst_image");
+    AllocScope parse_scope(PHASE_PARSE);
+    auto start = chrono::steady_clock::now();
+    // Collect the values by their place in the decode plan. Line order in the pst file is assumed to be scrambled.
+    // As in PstFile, the first of any duplicate lines is the one that counts.
+    vector<string> values(decode_plan.size());
+    vector<bool> found(decode_plan.size(), false);
+    vector<PackFeature> features;
+    
+    string line;
+    string line_code;
+    PstTextLine parsed;
+    while(getline(instream, line)) {
+        if (line[0] == '#') { continue; } // Ignore comments.
+        
+        parse_pst_line(line, parsed);
+        if (parsed.method == FEATURE) {
+            PackFeature feature;
+            if (! read_feature(parsed, feature)) return false;
+            features.push_back(feature);
+            continue;
+        }
+        line_code = parsed.section;
+        line_code += parsed.line_code;
+        int i = plan_index_for(line_code);
+        if (i < 0 || decode_plan[i].method != parsed.method || decode_plan[i].bytes != parsed.bytes) return false;
+        if (! found[i]) {
+            found[i] = true;
+            values[i] = parsed.value;
+        }
+    }
+    
+    auto parsed_at = chrono::steady_clock::now();
+    AllocScope encode_scope(PHASE_ENCODE);
+    
+    // Work out where each line goes, now that the TEXT lengths are known.
+    vector<size_t> offsets(decode_plan.size()+1);
+    size_t size = 0;
+    for (size_t i=0; i<decode_plan.size(); i++) {
+        if (! found[i]) return false;
+        offsets[i] = size;
+        const PstPlanLine & plan_line = decode_plan[i];
+        size += plan_line.method == TEXT ? 4 + values[i].length() + plan_line.bytes : plan_line.bytes;
+    }
+    offsets.back() = size;
+    
+    // Encode every line into the image. One scratch PstLine is reused to avoid building one per line.
+    image.assign(size, '\0');
+    unsigned char * out = (unsigned char *)&image[0];
+    PstLine scratch;
+    for (size_t i=0; i<decode_plan.size(); i++) {
+        const PstPlanLine & plan_line = decode_plan[i];
+        scratch.line_code = plan_line.line_code;
+        scratch.method = plan_line.method;
+        scratch.bytes = plan_line.bytes;
+        scratch.value.swap(values[i]);
+        scratch.encode_binary(out + offsets[i]);
+    }
+    // Put the features back into the maps. Going backwards lets the first of any duplicates win.
+    for (auto f = features.rbegin(); f != features.rend(); ++f) {
+        out[offsets[f->row] + f->column] = f->value;
+    }
+    if (stats) {
+        stats->parse_time += parsed_at - start;
+        stats->encode_time += chrono::steady_clock::now() - parsed_at;
+        count_packed(offsets, features, *stats);
+    }
+    return true;
+}
@@ -0,0 +1,23 @@
+//
+//  PgPacker.hpp
+//  pirates_savegame_editor
+//
+
+#ifndef PgPacker_hpp
+#define PgPacker_hpp
+
+#include <string>
+#include <istream>
+
+struct FileStats;
+
+// Packs a pst file straight into a savegame image, using the decode plan to find where each line goes.
+// Returns false, without writing anything, if the pst file does not line up exactly with the decode plan
+// (a missing, unknown, or retyped line, as in a pst from an older version). The caller should then use PstFile::write_pg.
+// With stats (for -stats), the time spent and the bytes and lines of each section are added to them.
+bool pack_pst(const std::string & pst_file, const std::string & pg_file, FileStats * stats = nullptr);
+
+// The same, but from pst text to a savegame image in memory.
+bool pack_pst_image(std::istream & pst_text, std::string & image, FileStats * stats = nullptr);
+
+#endif /* PgPacker_hpp */
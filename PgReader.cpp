@@ -0,0 +1,74 @@
+//
+//  PgReader.cpp
+//  pirates_savegame_editor
+//
+// Reading a whole savegame into memory once is much faster than reading it one field at a time from a stream.
+
+#include "PgReader.hpp"
+#include "Trace.hpp"
+#include <fstream>
+#include <stdexcept>
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#define PG_USE_MMAP 1
+#endif
+using namespace std;
+
+PgInput::PgInput(const std::string & filename) {
+    TraceSpan span("open", filename);
+#ifdef PG_USE_MMAP
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) throw runtime_error("Failed to read from " + filename);
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        throw runtime_error("Failed to read from " + filename);
+    }
+    length = (size_t)st.st_size;
+    if (length > 0) {
+        void * m = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (m != MAP_FAILED) {
+            bytes = (const unsigned char *)m;
+            mapped = true;
+        }
+    }
+    close(fd);
+    if (mapped || length == 0) return;
+#endif
+    // Portable fallback: one read of the whole file.
+    ifstream in(filename, ios::binary | ios::ate);
+    if (! in.is_open()) throw runtime_error("Failed to read from " + filename);
+    length = (size_t)in.tellg();
+    copy.resize(length);
+    in.seekg(0);
+    in.read((char *)copy.data(), length);
+    bytes = copy.data();
+}
+
+PgInput::~PgInput() {
+#ifdef PG_USE_MMAP
+    if (mapped) munmap((void *)bytes, length);
+#endif
+}
+
+const unsigned char * PgReader::read(size_t count) {
+    if (count > length - pos) throw logic_error("Unexpected end of savegame at byte " + to_string(pos));
+    const unsigned char * b = bytes + pos;
+    pos += count;
+    return b;
+}
+
+int PgReader::read_int() {
+    int B = int_at(pos);
+    pos += 4;
+    return B;
+}
+
+int PgReader::int_at(size_t position) const {
+    if (position + 4 > length) throw logic_error("Unexpected end of savegame at byte " + to_string(position));
+    const unsigned char * b = bytes + position;
+    return (int)(b[0] | b[1] << 8 | b[2] << 16 | (char)(b[3]) << 24);
+}
@@ -0,0 +1,52 @@
+//
+//  PgReader.hpp
+//  pirates_savegame_editor
+//
+
+#ifndef PgReader_hpp
+#define PgReader_hpp
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+// PgInput holds all of the bytes of a pirates_savegame file at once, memory mapped where the OS allows it.
+// PgReader is a cursor over those bytes, so the decoding can work directly from memory.
+
+class PgInput {
+public:
+    explicit PgInput(const std::string & filename);
+    ~PgInput();
+    PgInput(const PgInput &) = delete;
+    PgInput & operator=(const PgInput &) = delete;
+    
+    const unsigned char * data() const { return bytes; }
+    size_t size() const { return length; }
+    
+private:
+    const unsigned char * bytes = nullptr;
+    size_t length = 0;
+    bool mapped = false;
+    std::vector<unsigned char> copy;   // Used instead of the mapping if mmap is not available.
+};
+
+class PgReader {
+public:
+    PgReader(const unsigned char * data, size_t size, size_t pos=0) : bytes(data), length(size), pos(pos) {}
+    explicit PgReader(const PgInput & input) : PgReader(input.data(), input.size()) {}
+    
+    const unsigned char * read(size_t count);   // Returns the next count bytes and moves past them.
+    int read_int();                             // Reads 4 bytes (little endian) as a signed integer.
+    int int_at(size_t position) const;          // Same as read_int, but at any position without moving.
+    PgReader at(size_t position) const { return PgReader(bytes, length, position); }   // A second cursor into the same bytes.
+    void seek(size_t position) { pos = position; }
+    size_t tellg() const { return pos; }
+    bool eof() const { return pos >= length; }
+    
+private:
+    const unsigned char * bytes;
+    size_t length;
+    size_t pos;
+};
+
+#endif /* PgReader_hpp */
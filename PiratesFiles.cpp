@@ -8,8 +8,17 @@
 
 #include "PiratesFiles.hpp"
 #include "PstFile.hpp"
+#include "PgPacker.hpp"
+#include "PgImage.hpp"
+#include "PgOutput.hpp"
+#include "SweepCache.hpp"
+#include "PgGenerator.hpp"
 #include "ship_names.hpp"
 #include "PstLine.hpp"
+#include "PstStats.hpp"
+#include "SpliceMatcher.hpp"
+#include "Trace.hpp"
+#include "AllocCounter.hpp"
 #include <iostream>
 #include <sstream>
 #include <fstream>
@@ -17,14 +26,23 @@
 #include <vector>
 #include <regex>
 #include <set>
+#include <unordered_set>
+#include <memory>
+#include <algorithm>
+#include <chrono>
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <thread>
 #include "boost/filesystem.hpp"
 
 // Filename suffixes
 const std::string pg_suffix   = "pirates_savegame";
 const std::string pst_suffix  = "pst";
-const std::string test_suffix = pg_suffix + ".test";
+const std::string sweep_cache_name = ".pirates_sweep_cache";   // Kept in the save_dir
 
 extern std::string save_dir;
+extern int thread_count;
 
 using namespace std;
 
@@ -91,6 +109,18 @@ void print_advanced_help() {
     to parcel them out to the different output files.
     It also splits up the -clone, -set, and -donor appropriately.
     
+    For changing a few values without a pst file:
+    -get <line_codes> -in <files>
+    -set <line_code=value> -in <files>
+    
+    These work directly on the pirates_savegame files, which is much faster
+    than -unpack, editing, and -pack when only a few lines change.
+    The line_codes follow the same rules as -splice, so -get Ship_x_3_0
+    prints that line for every ship. -set takes comma separated
+    line_code=value pairs, and writes the value into every matching line,
+    in the same form as the pst file. The world map rows cannot be set this way.
+    A value can have a comma in it, as long as the comma is not followed by line_code=.
+    
     For automatic splicing:
     -auto -in <file> -out <files> -donor <files> [-not <files>]
     
@@ -108,17 +138,65 @@ void print_advanced_help() {
     After checking which of those files have the feature,
     they can be fed back in using -donor and -not for another round
     to quickly narrow down the target line_code.
+    The candidates come from comparing the pirates_savegame files directly,
+        so the pst files of the -in, -donor and -not files are not read.
+    
+    For speed:
+    -threads <n>
+    
+    Unpacks each file using n threads. The output is the same as with one thread.
+    With -splice or -auto, the output files are made n at a time instead.
+    
+    -trace <file>
+    
+    Writes a timeline of the work (opening files, unpacking each section,
+    compressing the map rows, reading and writing pst and savegame files,
+    each splice output and each auto round) to file as a Chrome trace.
+    Open it in chrome://tracing or ui.perfetto.dev to see each thread.
+    
+    -stats
+    
+    With -unpack, -pack, -test or -sweep, reports for each file and each section
+    the bytes decoded and encoded, the lines of each rmeth, the FEATURE lines,
+    the calls and hits of each translation, and the time spent decoding,
+    translating, formatting and on I/O. A batch ends with the totals,
+    and the files with the most features and the slowest files.
+    In a build with PIRATES_COUNT_ALLOCATIONS defined, -stats also ends with
+    the heap allocations, bytes, and peak live heap of each phase
+    (decode, translate, format, parse, encode, splice), for any operation.
+    
+    For synthetic savegames:
+    -generate <files> [-seed <n>]
+    
+    Writes savegames made up from random values that follow the layout,
+    for benchmarks and tests that do not depend on real saves.
+    The same seed always gives the same files.
+    
+    -fuzz <count> [-seed <n>]
+    
+    Runs the -test round trip on count synthetic savegames, in memory.
+    The first few that fail are written out as fuzz_<seed> files.
+    
+    -benchmark <name|all> [-iterations <n>]
+    
+    Times unpack, pack, test, splice and auto on synthetic savegames,
+    and the pieces inside them (each rmeth, the maps, pst parsing, translations).
+    Prints one JSON line per benchmark. Only names containing <name> are run.
     
     For regression:
     -test <files>
         
-    Unpacks the file, then repacks it, and then compares the resulting
-    pirates_savegame file to the original. Detects cases where information has
-    been lost in the unpack/pack combination.
+    Unpacks the file, then repacks it, and then compares the result
+    to the original, all without writing any files. Detects cases where
+    information has been lost in the unpack/pack combination, and names
+    the line_code of every line that did not come back the same.
         
     -sweep
         
     Runs -test on all available files in the directory given.
+    The results are kept in a .pirates_sweep_cache file in that directory,
+    and the next -sweep skips any file that has not changed since then,
+    unless the program itself has been rebuilt. Delete the file to test everything.
         
     )AUSAGE";
     cout << advanced_help_message;
@@ -131,25 +209,174 @@ void set_up_decoding() {
     set_up_rmeth();
     augment_decoder_groups();
     load_pirate_shipnames();
+    compile_decode_plan();
 }
 
-void comparePg(std::string afile) {
-    string short_file1 = afile + "." + pg_suffix;
-    string file1 = find_file(afile, pg_suffix);
-    ifstream fs1 = ifstream(file1, ios::binary);
-    if (! fs1.is_open()) throw runtime_error("Failed to read from " + short_file1);
-    
-    string short_file2 = afile + "." + test_suffix;
-    string file2 = find_file(afile, test_suffix);
-    ifstream fs2 = ifstream(file2, ios::binary);
-    if (! fs2.is_open()) throw runtime_error("Failed to read from " + short_file2);
-    
-    cout << "Comparing " << short_file1 << " to " << short_file2 << "\n";
-    compare_binary_filestreams(fs1,fs2); // Aborts on failure.
-    fs1.close();
-    fs2.close();
-    cout << "PASS!\n";
-    std::remove(file2.c_str());
+static vector<string> compare_images(const string & original, const string & repacked) {
+    // Lists each line whose bytes came out differently, with the byte range that differs.
+    constexpr int max_reports = 20;
+    vector<string> problems;
+    if (original.size() != repacked.size()) {
+        problems.push_back("Repacked size is " + to_string(repacked.size()) + " bytes, should be " + to_string(original.size()));
+    }
+    unique_ptr<PgImage> layout;
+    try {
+        layout = make_unique<PgImage>((const unsigned char *)original.data(), original.size());
+    } catch (exception & e) {
+        problems.push_back(string("Cannot find line_codes: ") + e.what());
+    }
+    size_t size = min(original.size(), repacked.size());
+    int reported = 0;
+    int unreported = 0;
+    for (size_t i=0; i<size; i++) {
+        if (original[i] == repacked[i]) continue;
+        // Extend the range to the end of this line, or to the next matching byte if there is no line_code.
+        size_t line_end = size;
+        string where;
+        if (layout) {
+            PgField field = layout->field_at(i);
+            line_end = min(size, field.offset + field.size);
+            where = " in " + field.plan_line->line_code;
+        }
+        size_t last = i;
+        for (size_t j=i+1; j<line_end; j++) {
+            if (original[j] != repacked[j]) { last = j; }
+            else if (! layout) { break; }
+        }
+        if (reported < max_reports) {
+            problems.push_back("Bytes " + to_string(i) + "-" + to_string(last) + " differ" + where);
+            reported++;
+        } else {
+            unreported++;
+        }
+        if (original.size() != repacked.size()) {
+            problems.push_back("Everything after that is shifted by the change in size");
+            break;
+        }
+        i = layout ? line_end - 1 : last;
+    }
+    if (unreported > 0) { problems.push_back("... and " + to_string(unreported) + " more"); }
+    return problems;
+}
+
+static string decode_failure(const string & original, size_t position, const exception & e) {
+    // Says where a savegame failed to unpack. With threads, the reader only knows which section it was in,
+    // so the lines are decoded one at a time from the layout to find the first one that fails.
+    string what = e.what();
+    unique_ptr<PgImage> layout;
+    try {
+        layout = make_unique<PgImage>((const unsigned char *)original.data(), original.size());
+    } catch (exception & layout_error) {
+        return what + " (" + layout_error.what() + ")";   // The layout names the TEXT line with the bad length.
+    }
+    for (int p=0; p<decode_plan.size(); p++) {
+        PgField field = layout->field(p);
+        try {
+            layout->read_line(field);
+        } catch (exception & line_error) {
+            return string(line_error.what()) + " at byte " + to_string(field.offset) + " in " + field.plan_line->line_code;
+        }
+    }
+    // Every line decodes on its own, so the problem came after decoding, in writing out the text.
+    if (position >= original.size()) return what + " at byte " + to_string(position);
+    return what + " near byte " + to_string(position) + " in " + layout->field_at(position).plan_line->line_code;
+}
+
+static vector<string> roundtrip_problems(const string & original, FileStats * stats = nullptr) {
+    // Unpacks, repacks, and compares, all in memory. Returns a list of what went wrong.
+    vector<string> problems;
+    PgReader reader((const unsigned char *)original.data(), original.size());
+    try {
+        string text;
+        try {
+            text = unpack_pst_text(reader, thread_count, stats);
+        } catch (exception & e) {
+            problems.push_back(decode_failure(original, reader.tellg(), e));
+            return problems;
+        }
+        if (! reader.eof()) {
+            problems.push_back("Found extra bits after byte " + to_string(reader.tellg()));
+        }
+        string repacked;
+        istringstream pst_in(text);
+        if (! pack_pst_image(pst_in, repacked, stats)) {
+            // The unpacked text should always match the plan, but this is a test, so check the slow way too.
+            problems.push_back("Unpacked text does not match the decode plan");
+            istringstream pst_again(text);
+            PstFile pst;
+            pst.read_pst(pst_again);
+            repacked = pst.pg_image();
+        }
+        auto differences = compare_images(original, repacked);
+        problems.insert(problems.end(), differences.begin(), differences.end());
+    } catch (exception & e) {
+        problems.push_back(e.what());
+    }
+    return problems;
+}
+
+bool test_roundtrip(std::string afile) {
+    // Returns true on a PASS.
+    string pg_file = find_file(afile, pg_suffix);
+    string short_file = regex_replace(pg_file, regex(".*\\/"), "");
+    TraceSpan span("test", pg_file);
+    unique_ptr<FileStats> stats;
+    if (collect_stats) { stats = make_unique<FileStats>(short_file, "test"); }
+    auto start = chrono::steady_clock::now();
+    recover_savegame(pg_file);
+    string original;
+    {
+        PgInput pg_in(pg_file);
+        original.assign((const char *)pg_in.data(), pg_in.size());
+    }
+    if (stats) { stats->read_time += chrono::steady_clock::now() - start; }
+    cout << "Testing " << short_file << "\n";
+    
+    auto problems = roundtrip_problems(original, stats.get());
+    if (problems.size() == 0) {
+        cout << "PASS!\n";
+    } else {
+        cout << "FAIL! " << short_file << "\n";
+        for (auto problem : problems) {
+            cout << "    " << problem << "\n";
+        }
+    }
+    if (stats) { report_stats(*stats); }
+    return problems.size() == 0;
+}
+
+int test_files(const std::vector<std::string> & list, bool use_cache) {
+    // Runs test_roundtrip on each file, and returns the number that failed.
+    // With use_cache, files that have not changed since they were last tested by this build are skipped.
+    SweepCache cache(save_dir + "/" + sweep_cache_name);
+    int failures = 0;
+    int skipped = 0;
+    for (size_t i=0; i<list.size(); i++) {
+        string pg_file = find_file(list[i], pg_suffix);
+        bool passed;
+        if (use_cache && cache.lookup(pg_file, passed)) {
+            skipped++;
+            if (! passed) {
+                cout << "FAIL! " << regex_replace(pg_file, regex(".*\\/"), "") << " (unchanged since the last sweep)\n";
+                failures++;
+            }
+            continue;
+        }
+        passed = test_roundtrip(list[i]);
+        if (! passed) { failures++; }
+        if (use_cache) {
+            cache.record(pg_file, passed);
+            if (i % 100 == 99) { cache.save(); }   // Keep most of the work if a long sweep is interrupted.
+        }
+    }
+    if (use_cache) { cache.save(); }
+    if (skipped > 0) {
+        cout << "Skipped " << skipped << " unchanged files\n";
+    }
+    if (list.size() > 1) {
+        cout << list.size() - failures << " of " << list.size() << " files passed\n";
+    }
+    return failures;
 }
 
 string find_file(string game, string suffix) {
@@ -176,36 +403,103 @@ string find_file(string game, string suffix) {
     exit(1);
 }
 
-void unpack(std::string afile, std::string extra_text) {
-    string pg_file = find_file(afile, pg_suffix);
+static void write_pst(PgReader & reader, const string & pg_file, const string & afile, const string & extra_text,
+                      FileStats * stats, int threads, ostream & log) {
+    // Decodes the savegame in reader into the pst file that goes with pg_file.
     string short_file1 = afile + "." + pg_suffix;
-    ifstream pg_in = ifstream(pg_file, ios::binary);
-    if (! pg_in.is_open()) throw runtime_error("Failed to read from " + pg_file);
-    
-    
     string pst_file = regex_replace(pg_file, regex(pg_suffix + "$"), pst_suffix);
     string short_file2 = afile + "." + pst_suffix;
     ofstream pst_out = ofstream(pst_file);
     if (! pst_out.is_open()) throw runtime_error("Failed to write to " + pst_file);
     
-    unpackPst(pg_in, pst_out);
-    pg_in.ignore(1);    // A little paranoia here. unpackPst reads only what it wants,
-    if (!pg_in.eof())   // I wanted to cover the case where there are extra bits in the pg file.
-        throw runtime_error("Found extra bits still in " + pg_file);
-    pg_in.close();
+    if (threads > 1) {
+        unpackPst_parallel(reader, pst_out, threads, stats);
+    } else {
+        unpackPst(reader, pst_out, stats);
+    }
+    if (!reader.eof())  // A little paranoia here. unpackPst reads only what it wants,
+        throw runtime_error("Found extra bits still in " + pg_file);  // I wanted to cover the case where there are extra bits in the pg file.
     
+    auto start = chrono::steady_clock::now();
     pst_out << extra_text;
     pst_out.close();
+    if (stats) { stats->write_time += chrono::steady_clock::now() - start; }
     
-    cout << "Translated " << short_file1 << " -> " << short_file2 << "\n";
+    log << "Translated " << short_file1 << " -> " << short_file2 << "\n";
+    if (stats) { report_stats(*stats); }
+}
+
+void unpack(std::string afile, std::string extra_text) {
+    string pg_file = find_file(afile, pg_suffix);
+    TraceSpan span("unpack", pg_file);
+    unique_ptr<FileStats> stats;
+    if (collect_stats) { stats = make_unique<FileStats>(afile + "." + pg_suffix, "unpack"); }
+    auto start = chrono::steady_clock::now();
+    recover_savegame(pg_file);
+    PgInput pg_in(pg_file);
+    PgReader reader(pg_in);
+    if (stats) { stats->read_time += chrono::steady_clock::now() - start; }
+    write_pst(reader, pg_file, afile, extra_text, stats.get(), thread_count, cout);
+}
+
+static void unpack_image(const string & image, const string & pg_file, const string & afile, const string & extra_text,
+                         int threads, ostream & log) {
+    // The same as unpack, for a savegame that was just written from image, so there is no need to read it back.
+    TraceSpan span("unpack", pg_file);
+    unique_ptr<FileStats> stats;
+    if (collect_stats) { stats = make_unique<FileStats>(afile + "." + pg_suffix, "unpack"); }
+    PgReader reader((const unsigned char *)image.data(), image.size());
+    write_pst(reader, pg_file, afile, extra_text, stats.get(), threads, log);
+}
+
+static void for_each_output(size_t count, const function<void(size_t oi, int threads, ostream & log)> & make_output) {
+    // The output files of splice and auto only read the shared inputs, so they can be made on separate threads.
+    // Their messages are held back and printed in order, so the log reads the same as with one thread.
+    // make_output is told how many threads it can use for its own unpack, and where to print.
+    int workers = (int)min<size_t>(thread_count, count);
+    if (workers <= 1) {
+        for (size_t oi=0; oi<count; oi++) { make_output(oi, thread_count, cout); }
+        return;
+    }
+    vector<ostringstream> logs(count);
+    vector<exception_ptr> errors(count);
+    atomic<size_t> next_output{0};
+    auto worker = [&]() {
+        for (size_t oi = next_output++; oi < count; oi = next_output++) {
+            try {
+                make_output(oi, 1, logs[oi]);
+            } catch (...) {
+                errors[oi] = current_exception();
+            }
+        }
+    };
+    vector<thread> threads;
+    for (int t=1; t<workers; t++) { threads.emplace_back(worker); }
+    worker();
+    for (auto && t : threads) { t.join(); }
+    
+    for (size_t oi=0; oi<count; oi++) {
+        cout << logs[oi].str();
+        if (errors[oi]) { rethrow_exception(errors[oi]); }
+    }
 }
 
-void testpack(string afile) {  pack(afile, test_suffix); }
 void pack(string afile)     {  pack(afile, pg_suffix); }
 
 void pack(string afile, string out_suffix) {
-    PstFile myPst(afile, pst_suffix);
-    myPst.write_pg(out_suffix);
+    string pst_file = find_file(afile, pst_suffix);
+    string pg_file  = regex_replace(pst_file, regex(pst_suffix + "$"), out_suffix);
+    TraceSpan span("pack", pst_file);
+    unique_ptr<FileStats> stats;
+    if (collect_stats) { stats = make_unique<FileStats>(regex_replace(pst_file, regex(".*\\/"), ""), "pack"); }
+    if (! pack_pst(pst_file, pg_file, stats.get())) {
+        // The pst file does not line up with the decode plan, so sort it out line by line.
+        auto start = chrono::steady_clock::now();
+        PstFile myPst(afile, pst_suffix);
+        if (stats) { stats->parse_time += chrono::steady_clock::now() - start; }
+        myPst.write_pg(out_suffix, stats.get());
+    }
+    if (stats) { report_stats(*stats); }
 }
 
 std::vector<std::string> find_pg_files() { // Used for -sweep. Returns short filenames.
@@ -224,14 +518,14 @@ std::vector<std::string> find_pg_files() { // Used for -sweep. Returns short fil
     return results;
 }
 
-static map<std::string, vector<std::regex> > regex_from_arg(std::string splices, int oi, unsigned long outfile_count, std::string & comment) {
+static map<std::string, vector<SpliceMatcher> > matchers_from_arg(std::string splices, int oi, unsigned long outfile_count, std::string & comment) {
     
     // This extracted routine takes comma separated arg for -splice or -clone
-    // and returns a list of regex. If the outfile_count is not 1, it parcels them out.
+    // and returns a list of matchers. If the outfile_count is not 1, it parcels them out.
     // It also updates a comment to go at the end of the pst file describing what was done.
     
     auto all_splices = split_by_commas(splices);
-    map<std::string, vector<regex> > splice_by_section;
+    map<std::string, vector<SpliceMatcher> > splice_by_section;
     if (all_splices.size() > 0) {
         for (auto i=oi % all_splices.size(); i<all_splices.size(); i += outfile_count) {
             auto asplice = all_splices[i];
@@ -243,11 +537,7 @@ static map<std::string, vector<std::regex> > regex_from_arg(std::string splices,
             string line_code = first_underscore == string::npos ? "" : asplice.substr(first_underscore, string::npos);
             comment += "," + section_name + line_code;
             // The line_code may contain _x as a wildcard.
-            line_code = regex_replace(line_code, regex("_x"), "_\\d+");
-            // Processing the -splice string values into two regular expressions to be checked against
-            // every line_code within a section.
-            splice_by_section[section_name].emplace_back(regex(line_code));
-            splice_by_section[section_name].emplace_back(regex(line_code + "_.*"));
+            splice_by_section[section_name].emplace_back(line_code);
         }
         comment = regex_replace(comment, regex("\\n,"), "") + "\n";
     }
@@ -266,20 +556,26 @@ void splice(std::string infile, std::string donor, std::string outfiles,
     PstFile donorPst(donor);
     auto all_sets = split_by_commas(set);
     
-    for (auto oi=0; oi<outfile_count; ++oi) {
+    // Every output file has to exist already. Find them all first, so a typo does not leave the job half done.
+    vector<string> out_pg_files;
+    for (auto && afile : all_outfiles) { out_pg_files.push_back(find_file(afile, pg_suffix)); }
+    
+    for_each_output(outfile_count, [&](size_t oi, int threads, ostream & log) {
         auto afile = all_outfiles[oi];
+        TraceSpan span("splice output", afile);
+        AllocScope scope(PHASE_SPLICE);   // Reading and writing the files count as parse, encode, and so on.
         string comment = "## Spliced\n## -in " + infile + "\n";
         if (donor != "") { comment += "## -donor " + donor + "\n"; }
         
         // If there is just one outfile, apply all splices to it.
         // If there are multiple outfiles, parcel out the splices, but everyone gets at least one.
         comment += "## -splice \n";
-        auto splice_by_section = regex_from_arg(splices, oi, outfile_count, comment);
+        auto splice_by_section = matchers_from_arg(splices, oi, outfile_count, comment);
     
         // clone can be comma-separated, so parcel out the clone regex if it exists too.
         // Doing this here because it is once per file, not once per section.
         if (clone != "") { comment += "## -clone \n"; }
-        auto clone_by_section = regex_from_arg(clone, oi, outfile_count, comment);
+        auto clone_by_section = matchers_from_arg(clone, oi, outfile_count, comment);
         
         if (set != "") { comment += "## -set " + set + "\n"; }
         
@@ -288,11 +584,11 @@ void splice(std::string infile, std::string donor, std::string outfiles,
         PstFile outPst;
         for (auto section : section_vector) {
             vector<Sortcode> lines_to_splice;
-            for (auto && [sortcode, aPstLine] : inPst[section]) {
+            for (auto && [sortcode, aPstLine] : inPst.lines(section.name)) {
                 bool did_splice_this_line = false;
                 if (splice_by_section.count(section.name)) {
-                    for (auto splice_line : splice_by_section[section.name]) {
-                        if (regex_match(aPstLine.line_code, splice_line)) {
+                    for (auto && splice_line : splice_by_section[section.name]) {
+                        if (splice_line.matches(sortcode, aPstLine.line_code)) {
                             lines_to_splice.push_back(sortcode);
                             did_splice_this_line = true;
                             break;
@@ -308,9 +604,9 @@ void splice(std::string infile, std::string donor, std::string outfiles,
             if (splice_by_section.count(section.name)) {
                 if (donor != "") {
                     // parse the donorPst and add in any lines that match the splice.
-                    for (auto && [sortcode, aPstLine] : donorPst[section]) {
-                        for (auto splice_line : splice_by_section[section.name]) {
-                            if (regex_match(aPstLine.line_code, splice_line)) {
+                    for (auto && [sortcode, aPstLine] : donorPst.lines(section.name)) {
+                        for (auto && splice_line : splice_by_section[section.name]) {
+                            if (splice_line.matches(sortcode, aPstLine.line_code)) {
                                 outPst[section].emplace(sortcode, PstLine(aPstLine));
                                 break;
                             }
@@ -319,9 +615,9 @@ void splice(std::string infile, std::string donor, std::string outfiles,
                 } else if (clone != ""){
                     
                     PstFile clonePst;  // This PstFile is just one section's worth of cloned lines.
-                    for (auto && [sortcode, aPstLine] : inPst[section]) {
-                        for (auto clone_line : clone_by_section[section.name]) {
-                            if (regex_match(aPstLine.line_code, clone_line)) {
+                    for (auto && [sortcode, aPstLine] : inPst.lines(section.name)) {
+                        for (auto && clone_line : clone_by_section[section.name]) {
+                            if (clone_line.matches(sortcode, aPstLine.line_code)) {
                                 clonePst[section].emplace(sortcode, PstLine(aPstLine));
                             }
                         }
@@ -333,10 +629,10 @@ void splice(std::string infile, std::string donor, std::string outfiles,
                         
                         //Make sure the replacement line is exactly of the same form as the line it replaced.
                         //This prevents splicing an INT in place of a SHORT.
-                        if (outPst[section][sortcode].bytes != inPst[section][sortcode].bytes ||
-                            outPst[section][sortcode].method != inPst[section][sortcode].method )
+                        if (outPst[section][sortcode].bytes != inPst.lines(section.name).at(sortcode).bytes ||
+                            outPst[section][sortcode].method != inPst.lines(section.name).at(sortcode).method )
                             throw invalid_argument("Problem with splice from " + section.name + outPst[section][sortcode].line_code +
-                                                   " into " + section.name + inPst[section][sortcode].line_code);
+                                                   " into " + section.name + inPst.lines(section.name).at(sortcode).line_code);
                         ++clone_iterator;
                         if (clone_iterator == clonePst[section].end()) {
                             clone_iterator = clonePst[section].begin();
@@ -347,75 +643,162 @@ void splice(std::string infile, std::string donor, std::string outfiles,
                     // There is no type-checking on the value because that seems hard.
                     size_t set_count = oi;
                     for (auto sortcode : lines_to_splice) {
-                        outPst[section].emplace(sortcode, PstLine(inPst[section][sortcode]));
+                        outPst[section].emplace(sortcode, PstLine(inPst.lines(section.name).at(sortcode)));
                         outPst[section][sortcode].value = all_sets[set_count];
                         set_count = (set_count + outfile_count) % all_sets.size();
                     }
                 }
             }
         }
-        outPst.set_filename(afile, pg_suffix);
-        outPst.write_pg();
-        
-        unpack(outPst.filename, comment);
+        outPst.filename = out_pg_files[oi];
+        auto image = outPst.write_pg(pg_suffix, nullptr, log);
+        unpack_image(image, outPst.filename, outPst.filename, comment, threads, log);
+    });
+}
+
+
+// The keys that read_pst gives the lines of each plan line, so that lines decoded straight from a savegame
+// line up with the lines of a pst file.
+namespace {
+struct PstKeys {
+    vector<Sortcode> sortcodes;                     // One per line of decode_plan. World map rows get the _293 that unpacking adds.
+    vector<bool> kept;                              // False if an earlier line of the section has the same sortcode, since read_pst keeps the first.
+    vector<unordered_set<Sortcode>> plan_lines;     // The sortcodes of each section, which also win over any feature with the same sortcode.
+    PstKeys() : sortcodes(decode_plan.size()), kept(decode_plan.size()), plan_lines(section_vector.size()) {
+        for (size_t p=0; p<decode_plan.size(); p++) {
+            auto && plan_line = decode_plan[p];
+            sortcodes[p] = index_to_sortcode(plan_line.line_code + (is_world_map(plan_line.method) ? "_293" : ""));
+            kept[p] = plan_lines[plan_line.section].insert(sortcodes[p]).second;
+        }
     }
+};
 }
 
+static map<Sortcode, PstLine> pst_lines(const PgImage & image, int plan_index, const PstKeys & keys) {
+    // The lines that one plan line puts in a pst file: the line itself, then the features of a world map row.
+    // The values are the same as read_pst would read back, so they can be compared the same way.
+    auto pst_value = [](PstLine & line) {
+        if (line.method==INT && line.v < 0) {   // Printed unsigned, as in the pst file.
+            line.value = to_string((unsigned int)line.v);
+        }
+        size_t first = line.value.find_first_not_of(' ');
+        line.value = first == string::npos ? "" : line.value.substr(first, line.value.find_last_not_of(' ') + 1 - first);
+    };
+    map<Sortcode, PstLine> lines;
+    vector<PstLine> features;
+    PstLine line = image.read_line(image.field(plan_index), features);
+    if (keys.kept[plan_index]) {
+        pst_value(line);
+        lines.emplace(keys.sortcodes[plan_index], line);
+    }
+    for (auto && feature : features) {
+        Sortcode sortcode = index_to_sortcode(feature.line_code);
+        if (keys.plan_lines[decode_plan[plan_index].section].count(sortcode)) continue;
+        pst_value(feature);
+        lines.emplace(sortcode, feature);
+    }
+    return lines;
+}
+
+static PgImage read_image(const string & afile) {
+    string pg_file = find_file(afile, pg_suffix);
+    cout << "Reading " << regex_replace(pg_file, regex(".*\\/"), "") << "\n";
+    return PgImage(pg_file);
+}
+
+static PstFile pst_from_image(const PgImage & image) {
+    PgReader reader((const unsigned char *)image.bytes().data(), image.bytes().size());
+    istringstream text(unpack_pst_text(reader, thread_count));
+    PstFile pst;
+    pst.read_pst(text);
+    return pst;
+}
 
 void auto_splice(std::string infile, std::string donorfiles, std::string outfiles, std::string notfiles) {
     
-    PstFile inPst(infile);
+    // The candidates are found from the savegames themselves, which takes one image per file instead of
+    // a whole PstFile. Only the -in file and the last donor are unpacked, to build the outputs from.
+    PgImage inImage = read_image(infile);
     auto all_outfiles = split_by_commas(outfiles);
     auto outfile_count = all_outfiles.size();
     
     auto all_donorfiles = split_by_commas(donorfiles);
-    auto oneDonor = PstFile(all_donorfiles.back());
+    PgImage oneDonorImage = read_image(all_donorfiles.back());
     all_donorfiles.pop_back();
-    vector<PstFile> donorPst;
-    for (auto afile : all_donorfiles) { donorPst.emplace_back(afile); }
+    vector<PgImage> donorImages;
+    for (auto afile : all_donorfiles) { donorImages.push_back(read_image(afile)); }
     
     auto all_notfiles = split_by_commas(notfiles);
-    vector <PstFile> notPst;
-    for (auto afile : all_notfiles) { notPst.emplace_back(afile); }
+    vector<PgImage> notImages;
+    for (auto afile : all_notfiles) { notImages.push_back(read_image(afile)); }
     
     // An auto-splice line comes from something observed in the donor files which is not in inPst or the notPst.
     //   - in the oneDonor, same value in other donors, different/missing in inPst and notPst
     //   - in inPst, not in any donors, same in notPst as in inPst - but for backward compatibility, these ARE NOT COUNTED.
+    // A line can only be in the oneDonor and not the same in inPst if its bytes are different, so only those plan lines
+    // are decoded, in every file, and compared line by line as the pst files would be.
     //
     map <std::string, set<Sortcode> >   splice_targets;
     vector<std::string> splice_lines;
     int splice_count = 0;
-    for (auto section : section_vector) {
-        for (auto && [sortcode, aPstLine] : (oneDonor)[section]) {
-            bool splice_it = true;
-            auto value = aPstLine.value;
+    {
+        TraceSpan span("auto_splice candidates");
+        AllocScope scope(PHASE_SPLICE);
+        PstKeys keys;
+        auto matches = [](const map<Sortcode, PstLine> & lines, Sortcode sortcode, const string & value) {
+            auto found = lines.find(sortcode);
+            return found != lines.end() && found->second.value == value;
+        };
+        for (int p : oneDonorImage.differing_lines(inImage)) {
+            const string & section_name = section_vector[decode_plan[p].section].name;
+            auto inLines = pst_lines(inImage, p, keys);
+            vector<map<Sortcode, PstLine>> donorLines, notLines;
+            for (auto && image : donorImages) { donorLines.push_back(pst_lines(image, p, keys)); }
+            for (auto && image : notImages)   { notLines.push_back(pst_lines(image, p, keys)); }
             
-            if (inPst.matches(section,sortcode,value)) { splice_it = false; }
-            for (auto && otherDonor : donorPst) {
-                if (! (otherDonor).matches(section,sortcode,value)) { splice_it = false; }
-            }
-            for (auto && otherNot : notPst) {
-                if ((otherNot).matches(section,sortcode,value)) { splice_it = false; }
-                // backward compatibility: inPst must match the -not files for any line that will be spliced.
-                if ((otherNot)[section].count(sortcode) && inPst[section].count(sortcode)) {
-                    string inVal = inPst[section][sortcode].value;
-                    if (! (otherNot).matches(section,sortcode,inVal)) { splice_it = false; }
+            for (auto && [sortcode, aPstLine] : pst_lines(oneDonorImage, p, keys)) {
+                bool splice_it = true;
+                auto value = aPstLine.value;
+            
+                if (matches(inLines,sortcode,value)) { splice_it = false; }
+                for (auto && otherDonor : donorLines) {
+                    if (! matches(otherDonor,sortcode,value)) { splice_it = false; }
+                }
+                for (auto && otherNot : notLines) {
+                    if (matches(otherNot,sortcode,value)) { splice_it = false; }
+                    // backward compatibility: inPst must match the -not files for any line that will be spliced.
+                    if (otherNot.count(sortcode) && inLines.count(sortcode)) {
+                        string inVal = inLines.at(sortcode).value;
+                        if (! matches(otherNot,sortcode,inVal)) { splice_it = false; }
+                    }
+                }
+                if (splice_it) {
+                    splice_count++;
+                    splice_targets[section_name].insert(sortcode);
+                    splice_lines.emplace_back(aPstLine.line_code);   // The full line_code, with the section.
                 }
-            }
-            if (splice_it) {
-                splice_count++;
-                splice_targets[section.name].insert(sortcode);
-                splice_lines.emplace_back(section.name + aPstLine.line_code);
             }
         }
     }
+    donorImages.clear();
+    notImages.clear();
+    PstFile inPst = pst_from_image(inImage);
+    PstFile oneDonor = pst_from_image(oneDonorImage);
     cout << "Total of " << splice_lines.size() << " candidate lines for auto-splicing\n";
     sort(splice_lines.begin(), splice_lines.end());
     
     // Now for the splice. We can splice just from the oneDonor (because all splice lines are the same
     // in all donors. Also, no need for regex, we have exact sortcodes / linecodes.
-    for (auto oi=0; oi<outfile_count; ++oi) {
+    // With few candidate lines, there is one output per line plus one with all of them, and any more outputs are left alone.
+    size_t used_outfile_count = outfile_count;
+    if (outfile_count > 1 && outfile_count > splice_count) { used_outfile_count = min<size_t>(outfile_count, splice_count + 1); }
+    vector<string> out_pg_files;
+    for (size_t oi=0; oi<used_outfile_count; oi++) { out_pg_files.push_back(find_file(all_outfiles[oi], pg_suffix)); }
+    
+    for_each_output(used_outfile_count, [&](size_t oi, int threads, ostream & log) {
         auto afile = all_outfiles[oi];
+        TraceSpan span("auto_splice round", afile);
+        AllocScope scope(PHASE_SPLICE);
         
         enum auto_mode {ALL, ONE, HALF};
         auto_mode mode;
@@ -426,19 +809,18 @@ void auto_splice(std::string infile, std::string donorfiles, std::string outfile
             // If we have very few candidate lines, put one in each outfile, but put them all in the first outfile.
             if (oi==0) mode = ALL;
             else mode = ONE;
-            if (oi > splice_count) { break; }
         } else {
             // If we have many splice lines, split them up between the outfiles to enable a binary search.
             mode = HALF;
         }
         
         if (mode == ALL) {
-            cout << "All lines test: " << afile << " <=";
-            for (auto aline : splice_lines) { cout << aline << " "; }
-            cout << "\n";
+            log << "All lines test: " << afile << " <=";
+            for (auto aline : splice_lines) { log << aline << " "; }
+            log << "\n";
         }
         if (mode == ONE) {
-            cout << "Single line test: " << afile << " <= " << splice_lines[oi-1] << "\n";
+            log << "Single line test: " << afile << " <= " << splice_lines[oi-1] << "\n";
         }
         
         
@@ -459,33 +841,128 @@ void auto_splice(std::string infile, std::string donorfiles, std::string outfile
             }
             if ((i+1) % flip == 0) { include = !include; }
         }
-        cout << "auto-splicing " << this_splice_count << " lines\n";
+        log << "auto-splicing " << this_splice_count << " lines\n";
         
         for (auto section : section_vector) {
-            for (auto && [sortcode, aPstLine] : (inPst)[section]) {
+            for (auto && [sortcode, aPstLine] : inPst.lines(section.name)) {
                 if (splice_sub_lines.count(section.name) &&
                     splice_sub_lines[section.name].count(aPstLine.line_code)) {
                     // All splices must exist in the donor (see above)
-                    outPst[section].emplace(sortcode, PstLine((oneDonor)[section][sortcode]));
+                    outPst[section].emplace(sortcode, PstLine(oneDonor.lines(section.name).at(sortcode)));
                 } else {
-                    outPst[section].emplace(sortcode, PstLine(inPst[section][sortcode]));
+                    outPst[section].emplace(sortcode, PstLine(inPst.lines(section.name).at(sortcode)));
                 }
             }
             // Also consider splice_targets that exist in oneDonor but not inPst.
-            for (auto && [sortcode, aPstLine] : (oneDonor)[section]) {
+            for (auto && [sortcode, aPstLine] : oneDonor.lines(section.name)) {
                 if ( splice_targets.count(section.name) ) {
                     if (splice_sub_lines.count(section.name) &&
                         splice_sub_lines[section.name].count(aPstLine.line_code) &&
-                        ! inPst[section].count(sortcode) ) {
-                        outPst[section].emplace(sortcode, PstLine((oneDonor)[section][sortcode]));
+                        ! inPst.lines(section.name).count(sortcode) ) {
+                        outPst[section].emplace(sortcode, PstLine(oneDonor.lines(section.name).at(sortcode)));
                     }
                 }
             }
         }
         
-        outPst.set_filename(afile, pg_suffix);
-        outPst.write_pg();
-        
-        unpack(afile, "## Auto Spliced\n");
+        outPst.filename = out_pg_files[oi];
+        auto image = outPst.write_pg(pg_suffix, nullptr, log);
+        unpack_image(image, outPst.filename, afile, "## Auto Spliced\n", threads, log);
+    });
+}
+
+
+void get_values(std::string infiles, std::string line_codes) {
+    // Reads single lines straight out of the pirates_savegame files, without unpacking them.
+    auto all_codes = split_by_commas(line_codes);
+    for (auto afile : split_by_commas(infiles)) {
+        PgImage image(find_file(afile, pg_suffix));
+        for (auto code : all_codes) {
+            auto fields = image.fields(code);
+            if (fields.size() == 0) throw invalid_argument("No line_code matches " + code);
+            for (auto field : fields) {
+                PstLine line = image.read_line(field);
+                if (line.method==INT && line.v < 0) {   // Printed unsigned, to match the pst file.
+                    line.value = to_string((unsigned int)line.v);
+                }
+                cout << afile << " : " << line.line_code << " : " << line.value << "\n";
+            }
+        }
+    }
+}
+
+static vector<string> split_assignments(const string & assignments) {
+    // Like split_by_commas, but a comma only starts a new assignment when a line_code and = come next,
+    // so that a TEXT value can have a comma in it.
+    vector<string> result;
+    size_t start = 0;
+    for (size_t comma = assignments.find(','); comma != string::npos; comma = assignments.find(',', comma+1)) {
+        size_t equals = assignments.find('=', comma+1);
+        if (equals == string::npos) break;
+        bool line_code = equals > comma+1 && all_of(assignments.begin() + comma + 1, assignments.begin() + equals,
+                                [](char c) { return isalnum((unsigned char)c) || c == '_'; });
+        if (! line_code) continue;
+        result.push_back(assignments.substr(start, comma-start));
+        start = comma+1;
+    }
+    result.push_back(assignments.substr(start));
+    return result;
+}
+
+void set_values(std::string infiles, std::string assignments) {
+    // Changes single lines straight in the pirates_savegame files, without unpacking and packing them.
+    vector<pair<string, string>> all_sets;
+    for (auto aset : split_assignments(assignments)) {
+        auto equals = aset.find('=');
+        if (equals == string::npos) throw invalid_argument("-set without -splice takes line_code=value, not " + aset);
+        all_sets.emplace_back(aset.substr(0, equals), aset.substr(equals+1));
+    }
+    for (auto afile : split_by_commas(infiles)) {
+        string pg_file = find_file(afile, pg_suffix);
+        PgImage image(pg_file);
+        int set_count = 0;
+        for (auto && [code, value] : all_sets) {
+            auto fields = image.fields(code);
+            if (fields.size() == 0) throw invalid_argument("No line_code matches " + code);
+            for (auto field : fields) {
+                image.write_value(image.field(field.plan_index), value);   // Fresh offsets, in case a TEXT line changed size.
+                set_count++;
+            }
+        }
+        write_savegame(pg_file, image.bytes());
+        cout << "Set " << set_count << " lines in " << afile << "." << pg_suffix << "\n";
+    }
+}
+
+void generate(std::string outfiles, uint64_t seed) {
+    // Writes synthetic savegames, one seed after another.
+    for (auto afile : split_by_commas(outfiles)) {
+        string pg_file = regex_replace(afile, regex("\\." + pg_suffix + "$"), "") + "." + pg_suffix;
+        write_savegame(pg_file, generate_savegame(seed));
+        cout << "Generated " << pg_file << " from seed " << seed << "\n";
+        seed++;
+    }
+}
+
+int fuzz(long count, uint64_t seed) {
+    // Round trips count synthetic savegames. Each failure is written out so that it can be unpacked and studied.
+    constexpr int max_failures_kept = 10;
+    int failures = 0;
+    for (long i=0; i<count; i++, seed++) {
+        string image = generate_savegame(seed);
+        auto problems = roundtrip_problems(image);
+        if (problems.size() == 0) continue;
+        failures++;
+        cout << "FAIL! seed " << seed << "\n";
+        for (auto problem : problems) {
+            cout << "    " << problem << "\n";
+        }
+        if (failures <= max_failures_kept) {
+            string pg_file = "fuzz_" + to_string(seed) + "." + pg_suffix;
+            write_savegame(pg_file, image);
+            cout << "    Saved as " << pg_file << "\n";
+        }
     }
+    cout << count - failures << " of " << count << " synthetic savegames passed\n";
+    return failures;
 }
@@ -12,10 +12,10 @@
 #include <string>
 #include <fstream>
 #include <vector>
+#include <cstdint>
 
 extern const std::string pg_suffix;
 extern const std::string pst_suffix;
-extern const std::string test_suffix;
 
 // These are the routines called in main() that correspond to the different switches.
 
@@ -25,18 +25,21 @@ void set_up_decoding();
 void unpack(std::string afile, std::string extra_text="");
 void pack(std::string afile);
 void pack(std::string afile, std::string suffix);
-void testpack(std::string afile);
-void comparePg(std::string afile);
+bool test_roundtrip(std::string afile);
+int test_files(const std::vector<std::string> & list, bool use_cache);
+void generate(std::string outfiles, uint64_t seed);
+int fuzz(long count, uint64_t seed);
 std::vector<std::string> find_pg_files();
 std::vector<std::string> split_by_commas(std::string);
 void splice(std::string infile, std::string donor, std::string outfiles,
             std::string splice, std::string clone, std::string set, std::string notfiles);
 void auto_splice(std::string infile, std::string donorfile, std::string outfiles, std::string notfiles);
+void get_values(std::string infiles, std::string line_codes);
+void set_values(std::string infiles, std::string assignments);
 
 // These are used internally.
 std::string find_file(std::string game, std::string suffix);
 std::vector<std::string> find_pg_files();
 std::vector<std::string> split_by_commas(std::string arg);
-void compare_binary_files(std::string file1, std::string file2);
 
 #endif /* PiratesFiles_hpp */
@@ -10,51 +10,47 @@
 
 #include "PstFile.hpp"
 #include "PstSection.hpp"
+#include "HexCodec.hpp"
+#include "PgOutput.hpp"
+#include "PstStats.hpp"
+#include "Trace.hpp"
+#include "AllocCounter.hpp"
 #include <string>
 #include <regex>
 #include <iostream>
-#include <iomanip>
-#include <sstream>
 #include <vector>
+#include <charconv>
+#include <limits>
+#include <chrono>
 using namespace std;
 
-void compare_binary_filestreams(std::ifstream & in1, std::ifstream & in2) {
-    constexpr int c = 16;  // This is like diff, but avoiding the unix system call to be portable with Windows.
-    char b1[c];
-    char b2[c];
-    
-    while(in1) {
-        in1.read((char*)&b1, c);
-        in2.read((char*)&b2, c);
-        string s1(b1,c);
-        string s2(b2,c);
-        if (s1 != s2) {
-            cout << "Failed at byte " << in1.tellg() << "\n";
-            abort();
-        }
-    }
-}
-
-Sortcode index_to_sortcode(std::string numbers) {
-    // Faster, non-regex version of routine below.
-    stringstream digits;
-    digits << "1";
-    size_t index = numbers.find_first_of('_');
-    size_t next_index;
+Sortcode index_to_sortcode(std::string_view numbers) {
+    // The sortcode is a 1 followed by the first six numbers of the line_code, each padded to 3 digits,
+    // so _23_0_2 becomes 1'023'000'002'000'000'000. This builds it arithmetically, with the same result
+    // as reading the padded digits with stoull (which stops at the first character that is not a digit).
+    constexpr Sortcode limit = numeric_limits<Sortcode>::max() / 10;
+    Sortcode sortcode = 1;
+    auto add_digit = [&](int d) {
+        if (sortcode > limit || (sortcode == limit && d > (int)(numeric_limits<Sortcode>::max() % 10)))
+            throw out_of_range("index_to_sortcode: " + string(numbers));
+        sortcode = sortcode*10 + d;
+    };
+    size_t index = numbers.find('_');
     for (auto i=0; i<6; i++) {
-        if (index != string::npos) {
-            next_index = numbers.find_first_of('_', index+1);
-            if (next_index == string::npos) {
-                digits << setw(3) << setfill ('0') << numbers.substr(index+1, next_index);
-            } else {
-                digits << setw(3) << setfill ('0') << numbers.substr(index+1, next_index-index-1);
-            }
-            index = next_index;
-        } else {
-            digits << "000";
+        if (index == string_view::npos) {
+            for (auto z=0; z<3; z++) { add_digit(0); }
+            continue;
+        }
+        size_t next_index = numbers.find('_', index+1);
+        string_view number = numbers.substr(index+1, next_index == string_view::npos ? string_view::npos : next_index-index-1);
+        for (auto z=number.length(); z<3; z++) { add_digit(0); }
+        for (char c : number) {
+            if (c < '0' || c > '9') { return sortcode; }
+            add_digit(c - '0');
         }
+        index = next_index;
     }
-    return stoull(digits.str());
+    return sortcode;
 }
 
 int sortcode_get_index(Sortcode sortcode, const int index) { // The sortcode is a numeric version of the linecode,
@@ -64,60 +60,33 @@ int sortcode_get_index(Sortcode sortcode, const int index) { // The sortcode is
     return (int) (sortcode % 1000);
 }
 
-std::vector<size_t> special_fast_regex(const std::string & line, const std::string & front_set, const std::string & back_set ) {
-    // This routine optimizes searching in a string to find the locations of substrings that can be pulled out
-    // using substr. It replaces a regex that is of the special form ^([^a]+)([^b+])...(.*?)..([^y+])([^z+])$
-    // where you can find all of the boundaries by making a pass from the front followed by a pass from the back.
-    // The input values are the tokens the indicate passing from one capture group to the next.
-    // Note that d, D act like \d, \D, and S acts like not-space.
-    size_t rsize = front_set.length() + back_set.length()+2;
-    auto r = std::vector<size_t>(rsize);
-    r[0] = 0;
-    size_t fsize = front_set.length();
-    for (size_t i=0; i < fsize; ++i) {
-        switch (front_set[i]) {
-            case 'D':
-                r[i+1] = line.find_first_not_of("1234567890", r[i]);
-                break;
-            case 'S':
-                r[i+1] = line.find_first_not_of(" ", r[i]);
-                break;
-            case 'd':
-                r[i+1] = line.find_first_of("1234567890", r[i]);
-                break;
-            default:
-                r[i+1] = line.find(front_set[i],r[i]);
-        }
-    }
-    r[rsize-1] = string::npos;
-    size_t bsize = back_set.length();
-    for(size_t i=bsize; i!=0; --i) {
-        switch(back_set[i-1]) {
-            case 'D':
-                r[fsize+i] = line.find_last_not_of("1234567890",r[fsize+i+1]);
-                break;
-            case 'S':
-                r[fsize+i] = line.find_last_not_of(" ",r[fsize+i+1]);
-                break;
-            case 'd':
-                r[fsize+i] = line.find_last_of("1234567890",r[fsize+i+1]);
-                break;
-            default:
-                r[fsize+i] = line.rfind(back_set[i-1],r[fsize+i+1]);
-        }
-    }
-    // When we find from the back, the boundary is shifted off-by-one.
-    for(size_t i=bsize; i!=0; --i) { ++r[fsize+i]; }
-    return r;
-}
-
-inline
-std::string special_fast_regex_result(const std::string & str, const std::vector<size_t> & r, size_t index) {
-    return str.substr(r[index],r[index+1]-r[index]);
+void parse_pst_line(std::string_view line, PstTextLine & parsed) {
+    // A pst line looks like   Ship_23_0_2   : s2  : 5         : comment translation
+    // Fields are found in one pass from the front, up to the start of the value.
+    // The end of the value is found from the back: the last non-space before the space before the last colon.
+    // (This used to be a regex of the form ^([^_]+)(_\S+) +: +(\D+)(\d+) +: +(.*?) +:.*$ )
+    constexpr string_view digits = "1234567890";
+    size_t section_end   = line.find('_');
+    size_t code_end      = line.find(' ', section_end);
+    size_t typecode      = line.find_first_not_of(' ', line.find(' ', line.find(':', code_end)));
+    size_t bytes_start   = line.find_first_of(digits, typecode);
+    size_t bytes_end     = line.find(' ', bytes_start);
+    size_t value_start   = line.find_first_not_of(' ', line.find(' ', line.find(':', bytes_end)));
+    size_t value_end     = line.find_last_not_of(' ', line.rfind(' ', line.rfind(':'))) + 1;
+    
+    parsed.section   = line.substr(0, section_end);
+    parsed.line_code = line.substr(section_end, code_end-section_end);
+    parsed.method    = meth_for_char(line.substr(typecode, bytes_start-typecode));
+    string_view bytes = line.substr(bytes_start, bytes_end-bytes_start);
+    auto result = from_chars(bytes.data(), bytes.data()+bytes.length(), parsed.bytes);
+    if (result.ec == errc::invalid_argument) throw invalid_argument("Bad byte count in pst line: " + string(line));
+    if (result.ec == errc::result_out_of_range) throw out_of_range("Bad byte count in pst line: " + string(line));
+    parsed.value     = line.substr(value_start, value_end-value_start);
 }
 
 void PstFile::read_pst(std::string afile, std::string suffix) {
     filename = find_file(afile, suffix);
+    TraceSpan span("read_pst", filename);
     auto instream = std::ifstream (filename);
     if (! instream.is_open()) {
         std::cerr << "Failed to read from " << filename << "\n";
@@ -125,65 +94,107 @@ void PstFile::read_pst(std::string afile, std::string suffix) {
     }
     std::string short_file = regex_replace(filename, std::regex(".*\\/"), "");
     std::cout << "Reading " << short_file << "\n";
-    
+    read_pst(instream);
+    instream.close();
+}
+
+void PstFile::read_pst(std::istream & instream) {
+    AllocScope scope(PHASE_PARSE);
     string line;
+    PstTextLine parsed;
+    string section_name;
+    map<Sortcode, PstLine> * section = nullptr;
     while(getline(instream, line)) {
         if (line[0] == '#') { continue; } // Ignore comments.
         
-        auto r = special_fast_regex(line, "_ : Sd : S", "S :");
-        string section   = special_fast_regex_result(line, r, 0);
-        string line_code = special_fast_regex_result(line, r, 1);
-        rmeth method =  meth_for_char(special_fast_regex_result(line, r, 5));
-        int bytes   = stoi(special_fast_regex_result(line, r, 6));
-        string value     = special_fast_regex_result(line, r, 10);
+        parse_pst_line(line, parsed);
+        
+        // Lines of a section are usually together, so only look up the section when it changes.
+        if (section == nullptr || parsed.section != section_name) {
+            section_name = parsed.section;
+            section = &data[section_name];
+        }
         
         // Convert the line_code numbers into a big integer for quick sorting.
         // Line order in the pst file is assumed to be scrambled.
-        Sortcode sortcode = index_to_sortcode(line_code);
+        Sortcode sortcode = index_to_sortcode(parsed.line_code);
         
-        data[section].emplace(sortcode,PstLine{line_code, method, bytes, value} );
+        section->try_emplace(sortcode, string(parsed.line_code), parsed.method, parsed.bytes, string(parsed.value));
     }
-    instream.close();
 }
 
-void PstFile::write_pg(std::string suffix) {
+std::string PstFile::write_pg(std::string suffix, FileStats * stats, std::ostream & log) {
     string pg_file    = regex_replace(filename, regex(pst_suffix + "$"), suffix);
     string short_file = regex_replace(pg_file, regex(".*\\/"), "");
-    auto outstream = ofstream(pg_file);
-    if (! outstream.is_open()) throw runtime_error("Failed to write_to " + pg_file);
-    cout << "Writing " << short_file << "\n";
+    TraceSpan span("write_pg", pg_file);
+    auto start = chrono::steady_clock::now();
+    string image = pg_image(stats);   // Built before writing, so a bad value does not leave behind a broken file.
+    auto encoded_at = chrono::steady_clock::now();
+    log << "Writing " << short_file << "\n";
+    write_savegame(pg_file, image);
+    if (stats) {
+        stats->encode_time += encoded_at - start;
+        stats->write_time += chrono::steady_clock::now() - encoded_at;
+    }
+    return image;
+}
+
+std::string PstFile::pg_image(FileStats * stats) const {
+    // Renders the whole savegame into one buffer. Sections go in section_vector order, lines in sortcode order.
+    // Missing sections are simply left out, to support changing the section_vector.
+    // With stats, each section gets its bytes and its lines by rmeth, the same as pack_pst_image counts them.
+    AllocScope scope(PHASE_ENCODE);
+    size_t size = 0;
+    for (const auto & section : section_vector) {
+        auto found = data.find(section.name);
+        if (found == data.end()) { continue; }
+        for (const auto & pair : found->second) {
+            size += pair.second.binary_size();
+        }
+    }
     
-    for (auto section : section_vector) {
-        if (data[section.name].size() == 0 ) { continue; }  // Support for changing the section_vector
+    string image(size, '\0');
+    unsigned char * out = (unsigned char *)&image[0];
+    unordered_map<Sortcode, pair<unsigned char *, int> > map_rows;   // Where each row went, and its width.
+    for (int s=0; s<section_vector.size(); s++) {
+        const auto & section = section_vector[s];
+        auto found = data.find(section.name);
+        if (found == data.end()) { continue; }
+        const auto & lines = found->second;
+        SectionStats * section_stats = stats ? &stats->sections[s] : nullptr;
         
-        if (is_world_map(section.splits.front().method)) {
-            // First, expand all of the non-FEATURE strings to full size.
-            for (auto&& pair : data[section.name]) {
-                if (pair.second.method != FEATURE) {
-                    pair.second.expand_map_value();
-                }
-            }
-            // Then, insert the features into the expanded maps.
-            for (auto&& pair : data[section.name]) {
-                if (pair.second.method == FEATURE) {  // FeatureMap_35_202  : F1 : 10 : (Landmark)
-                    // pair.first = 1'032'202'000'000'000'000
-                    int row = sortcode_get_index(pair.first,1);
-                    int col = sortcode_get_index(pair.first,2);
-                    
-                    // 293 is a magic number: the width of a map.
-                    // For a Feature at FeatureMap_35_202,
-                    // we need to edit FeatureMap_35_293 column 202, so construct the appropriate line_code, and edit that PstLine.
-                    Sortcode target = index_to_sortcode("_" + to_string(row) + "_293");
-                    if (data[section.name].count(target) != 1) throw logic_error ("Tried to add features to missing row");
-                    data[section.name].at(target).update_map_value(col, pair.second.value);
-                }
+        // The map rows expand straight from their compressed form. Note where each one went, for the features.
+        map_rows.clear();
+        for (const auto & pair : lines) {
+            if (is_world_map(pair.second.method)) { map_rows[pair.first] = {out, pair.second.bytes}; }
+            pair.second.encode_binary(out);
+            out += pair.second.binary_size();
+            if (section_stats) {
+                section_stats->bytes_encoded += pair.second.binary_size();
+                section_stats->lines[pair.second.method]++;
             }
         }
+        if (! is_world_map(section.splits.front().method)) { continue; }
         
-        // Now we are ready to write out the binary for the section.
-        for (auto&& pair : data[section.name]) {
-            pair.second.write_binary(outstream);
+        // Then, put the features into the maps.
+        for (const auto & pair : lines) {
+            if (pair.second.method == FEATURE) {  // FeatureMap_35_202  : F1 : 10 : (Landmark)
+                // pair.first = 1'032'202'000'000'000'000
+                int row = sortcode_get_index(pair.first,1);
+                int col = sortcode_get_index(pair.first,2);
+                
+                // 293 is a magic number: the width of a map, which unpacking puts at the end of each row's line_code.
+                // For a Feature at FeatureMap_35_202, we need to edit FeatureMap_35_293 column 202.
+                auto target = map_rows.find(index_to_sortcode("_" + to_string(row) + "_293"));
+                if (target == map_rows.end()) throw logic_error ("Tried to add features to missing row");
+                auto [row_out, row_bytes] = target->second;
+                if (col >= row_bytes) throw invalid_argument("Feature is off the edge of the map: " + pair.second.line_code);
+                const string & value = pair.second.value;
+                if (value.length() != 2 || ! hex_decode(value.data(), 1, row_out + col))
+                    throw invalid_argument("Feature is not one hex byte: " + pair.second.line_code);
+                if (section_stats) { section_stats->features++; }
+            }
         }
     }
-    outstream.close();
+    return image;
 }
@@ -11,6 +11,7 @@
 
 #include <stdio.h>
 #include <string>
+#include <string_view>
 #include <map>
 #include <vector>
 #include <fstream>
@@ -23,15 +24,29 @@
 
 using Sortcode = unsigned long long;
 
-void compare_binary_filestreams(std::ifstream & in1, std::ifstream & in2);
-Sortcode index_to_sortcode(std::string numbers);
+Sortcode index_to_sortcode(std::string_view numbers);
+int sortcode_get_index(Sortcode sortcode, const int index);
+
+// The fields of one line of a pst file. The comment and translation are not kept.
+// The views point into the line, so they are only good until the line changes.
+struct PstTextLine {
+    std::string_view section;     // Ship
+    std::string_view line_code;   // _23_0_2  (the rest of the line_code, after the section)
+    rmeth method;
+    int bytes;
+    std::string_view value;
+};
+void parse_pst_line(std::string_view line, PstTextLine & parsed);
 
 class PstFile {
 public:
     std::string filename;
     
     void read_pst(std::string afile, std::string suffix);
-    void write_pg(std::string suffix=pg_suffix);
+    void read_pst(std::istream & instream);
+    // Returns the image it wrote.
+    std::string write_pg(std::string suffix=pg_suffix, FileStats * stats=nullptr, std::ostream & log=std::cout);
+    std::string pg_image(FileStats * stats=nullptr) const;   // The binary savegame, as write_pg would write it.
     
     PstFile() {}
     explicit PstFile(std::string afile, std::string suffix=pst_suffix) { read_pst(afile, suffix); }
@@ -41,9 +56,16 @@ public:
     
     // Syntactic Sugar
     std::map<Sortcode, PstLine> & operator[](PstSection & section){ return data[section.name]; }
-    bool matches(const PstSection & section, Sortcode sortcode, const std::string & value) {
-        return data[section.name].count(sortcode) != 0 &&
-        data[section.name][sortcode].value == value;
+    // Read only access, which several threads can share.
+    const std::map<Sortcode, PstLine> & lines(const std::string & section_name) const {
+        static const std::map<Sortcode, PstLine> none;
+        auto found = data.find(section_name);
+        return found == data.end() ? none : found->second;
+    }
+    bool matches(const PstSection & section, Sortcode sortcode, const std::string & value) const {
+        const auto & section_lines = lines(section.name);
+        auto found = section_lines.find(sortcode);
+        return found != section_lines.end() && found->second.value == value;
     }
 };
 
@@ -15,9 +15,11 @@
 // but the result is not put into the PstLine, it is returned as a string.
 // This is so complicated translations can be built up from different smaller translations.
 
-#include "PstLine.hpp"      // For the read_int routine, needed for starting_year.
+#include "PstLine.hpp"
 #include "ship_names.hpp"   // ship_names is a subset of PstLine translation
 #include <stdio.h>
+#include <cstring>
+#include <charconv>
 #include <unordered_map>
 #include <vector>
 #include <string>
@@ -30,11 +32,15 @@
 #include <iomanip>
 #include <iostream>
 #include <fstream>
+#include <algorithm>
 #include "RMeth.hpp"
+#include "HexCodec.hpp"
+#include "MapCodec.hpp"
+#include "Trace.hpp"
+#include "AllocCounter.hpp"
 using namespace std;
 
 const int number_of_true_cities = 44; // Cities after this number are settlements, indian villages, Jesuit missions, or pirate bases.
-int starting_year;
 
 constexpr char hexchar_for_int[] = "0123456789abcdef";
 constexpr char hexCHAR_for_int[] = "0123456789ABCDEF";
@@ -55,6 +61,24 @@ enum translatable : char {
     PEACE_AND_WAR, DATE_AND_AGE, TREASURE_MAP, LANDMARK,
     // If it is not mapped in either, that is not an error: it is hook for future code).
 };
+static_assert(LANDMARK < translatable_slots, "SectionStats needs a slot for every translatable");
+
+const char * translatable_name(int t) {
+    static const char * const names[] = {
+        "NIL", "NONE", "RANK", "DIFFICULTY", "NATION", "FLAG", "SKILL", "SPECIAL_MOVE", "SHIP_TYPE",
+        "DISPOSITION", "BEAUTY", "SHORT_UPGRADES", "LONG_UPGRADES", "CITYNAME", "DIR16",
+        "DIR8", "PIRATE",
+        "EVENT", "EVENTS3", "EVENTS15", "EVENTS32", "EVENTS64",
+        "PURPOSE", "PURPOSE0", "PURPOSE30", "PURPOSE40",
+        "WEALTH_CLASS", "POPULATION_CLASS", "SOLDIERS", "FLAG_TYPE", "SPECIALIST",
+        "ITEM", "BETTER_ITEM", "PIRATE_HANGOUT",
+        "SHIPNAME", "STORE_CITYNAME", "DATE", "FOLLOWING", "CITY_BY_LINECODE", "WEALTH", "POPULATION",
+        "POPULATION_TYPE", "ACRES", "LUXURIES_AND_SPICES", "BEAUTY_AND_SHIPWRIGHT", "FURTHER_EVENT", "SHIP_SPECIALIST",
+        "PEACE_AND_WAR", "DATE_AND_AGE", "TREASURE_MAP", "LANDMARK",
+    };
+    static_assert(sizeof(names)/sizeof(names[0]) == LANDMARK+1, "translatable names are out of step with the enum");
+    return t <= LANDMARK ? names[t] : "?";
+}
 
 // Utilities?
 int index_from_linecode (const std::string & line_code) { // Given Ship_23_1_4, returns 23
@@ -99,8 +123,6 @@ unordered_map <translatable, vector<string>> translation_lists = {
         "chain shot", "grape shot", "fine grain powder", "bronze cannon"}},
     { DIR16, {"N", "NNE", "NE", "ENE", "E", "ESE", "SE", "SSE", "S", "SSW", "SW", "WSW", "W", "WNW", "NW", "NNW", "N"}},
     { DIR8, {"N", "NE", "E", "SE", "S", "SW", "W", "NW", "N"}},
-    // CITYNAME is loaded during the reading of the CityName section, for use in other sections
-    { CITYNAME, vector<string> (128) },
     { WEALTH_CLASS, {"quiet and desolate", "baking in the sun", "bustling with activity","clean and prosperous", "brimming with wealth",}},
     { POPULATION_CLASS, {"Farmers", "Colonists",  "Craftsmen", "Landowners", "Citizens","Merchants"}},
     { SPECIALIST, {"carpenter", "sailmaker", "cooper", "gunner", "surgeon", "navigator", "quartermaster", "cook"}},
@@ -130,11 +152,12 @@ unordered_map <translatable, vector<string>> translation_lists = {
 };
 
 // Translations that require special effort or which are called to store data.
-unordered_map <translatable, string (*)(const PstLine & i)> translation_functions = {
+unordered_map <translatable, string (*)(const PstLine & i, DecodeContext & ctx)> translation_functions = {
     { SHIPNAME, translate_shipname },
     { SHIP_TYPE, save_last_shiptype },  // Is this really that much better than a switch/case statement?
     { STORE_CITYNAME, store_cityname }, // Turns out it is. Having lots of little functions
     { FLAG, store_flag },               // makes it possible to compose them.
+    { CITYNAME, translate_cityname_value }, // The citynames are loaded into the DecodeContext.
     { DATE, translate_date },
     { FOLLOWING, translate_following },
     { SHIP_SPECIALIST, translate_ship_specialist },
@@ -156,34 +179,40 @@ unordered_map <translatable, string (*)(const PstLine & i)> translation_function
 
 
 
-string translate_soldiers(const PstLine & i) {
+string translate_soldiers(const PstLine & i, DecodeContext &) {
     if (i.v > 0) { return to_string(i.v*20);}
     else { return "None";}
 }
-string translate_acres(const PstLine & i) { return to_string(50*i.v) + " acres"; }
+string translate_acres(const PstLine & i, DecodeContext &) { return to_string(50*i.v) + " acres"; }
 
-string translate_luxuries_and_spices(const PstLine & i) {
+string translate_luxuries_and_spices(const PstLine & i, DecodeContext &) {
     int as_int = i.v/2;
     if (as_int > 49 || as_int < 0) { as_int = 49;}   // TODO: This may be mimicing a bug in the perl
     if (as_int == 0) { return ""; }
     return to_string(as_int);
 }
-string translate_pirate_hangout(const PstLine & i) {
+string translate_pirate_hangout(const PstLine & i, DecodeContext & ctx) {
     if (i.v == -1) { return "N/A"; }
-    return simple_translate(CITYNAME, i.v);
+    return translate_cityname(i.v, ctx);
 }
-string translate_population(const PstLine & i) {  return to_string( 200 * (int)(unsigned char)i.v); }
-string translate_following(const PstLine & i) {
+string translate_population(const PstLine & i, DecodeContext &) {  return to_string( 200 * (int)(unsigned char)i.v); }
+string translate_following(const PstLine & i, DecodeContext &) {
     if (i.v == -2) { return "following player";}
     else { return ""; }
 }
 
-string store_cityname (const PstLine & i) {
+string store_cityname (const PstLine & i, DecodeContext & ctx) {
     // Save names of cities for later translations.
     int index = index_from_linecode(i.line_code);
-    translation_lists[CITYNAME][index] = i.value;
+    ctx.citynames[index] = i.value;
+    return "";
+}
+
+string translate_cityname (const int index, const DecodeContext & ctx) {
+    if (index >= 0 && index < ctx.citynames.size()) { return ctx.citynames[index]; }
     return "";
 }
+string translate_cityname_value (const PstLine & i, DecodeContext & ctx) { return translate_cityname(i.v, ctx); }
 
 
 string simple_translate (const translatable t, const int as_int) {
@@ -207,7 +236,7 @@ string simple_translate (const translatable t, const int as_int) {
     return "";
 }
 
-string translate(const translatable t, const PstLine & i) {
+string translate(const translatable t, const PstLine & i, DecodeContext & ctx) {
     if (t == NIL) { return ""; }
     
     string return_value = "";
@@ -215,7 +244,7 @@ string translate(const translatable t, const PstLine & i) {
     if (translation_functions.count(t)) {
         // Special translations that require their own functions,
         // or which store this data for future translations.
-        return_value = translation_functions.at(t)(i);
+        return_value = translation_functions.at(t)(i, ctx);
     }
     
     if (translation_lists.count(t)) {
@@ -232,25 +261,24 @@ string translate(const translatable t, const PstLine & i) {
     return return_value;
 }
 
-string store_flag(const PstLine & i){
-    save_last_flag(simple_translate(FLAG, i.v)); // ship_names depend on the nationality of the ship.
+string store_flag(const PstLine & i, DecodeContext & ctx){
+    ctx.last_flag = simple_translate(FLAG, i.v); // ship_names depend on the nationality of the ship.
     return "";
 }
 
-vector<int> stored_city_wealth (128);
-string translate_wealth(const PstLine & i) {
+string translate_wealth(const PstLine & i, DecodeContext & ctx) {
     int index = index_from_linecode(i.line_code);
-    stored_city_wealth[index] = i.v;   // The wealth of the city will be needed later to describe the population
+    ctx.stored_city_wealth[index] = i.v;   // The wealth of the city will be needed later to describe the population
     if (i.v != 300 ) {
         return simple_translate(WEALTH_CLASS, i.v/40 );
     } else { return ""; }
 }
 
-string translate_population_type (const PstLine & i) {
+string translate_population_type (const PstLine & i, DecodeContext & ctx) {
     // Cities are classified as having different sorts of population as a combination
     // of the Economy CityInfo_x_0_4 and the wealth City_x_5
     
-    int magic_number = (int)translation_lists[POPULATION_CLASS].size() /2; // == 3
+    int magic_number = (int)translation_lists.at(POPULATION_CLASS).size() /2; // == 3
     
     int index = index_from_linecode(i.line_code);
     if (index >= number_of_true_cities) { return ""; } // Settlements do not get this
@@ -260,12 +288,12 @@ string translate_population_type (const PstLine & i) {
         pop_group = magic_number-1;
     } // Probably mimicing perl incorrect handling of negative numbers here.
     
-    int is_wealthy = (stored_city_wealth[index] > 100) ? 1:0;
+    int is_wealthy = (ctx.stored_city_wealth[index] > 100) ? 1:0;
     
     return simple_translate(POPULATION_CLASS, (int)pop_group + magic_number*is_wealthy);
 }
 
-string translate_event_flags(const PstLine & i) {
+string translate_event_flags(const PstLine & i, DecodeContext &) {
     std::bitset<8> asbits(i.v);
     string retval = "";
     for (int j=0; j<6; j++) {  // Main nations reported only, plus Pirates and Indians?
@@ -277,26 +305,23 @@ string translate_event_flags(const PstLine & i) {
     return retval;
 }
 
-int stored_event; // Events in the log file are spread across 8 lines
-int subevent;     // and I need a little bit of state to decode the later lines.
-int temp_i;
-string translate_event(const PstLine & i) {
+string translate_event(const PstLine & i, DecodeContext & ctx) {
     auto as_two = make_pair(i.v/16, i.v%16);
     int index = suffix_from_linecode(i.line_code);
     switch (index) {
         case 0:
-            stored_event = i.v;
-            subevent = 0;
+            ctx.stored_event = i.v;
+            ctx.subevent = 0;
             return "";
         case 1:
-            if (i.v < 0) return "Greatly pleased " + translate_event_flags(i);
-            if (i.v > 0) return "Pleased " + translate_event_flags(i);
+            if (i.v < 0) return "Greatly pleased " + translate_event_flags(i, ctx);
+            if (i.v > 0) return "Pleased " + translate_event_flags(i, ctx);
             return "";
         case 2:
-            if (i.v > 0) return "Offended " + translate_event_flags(i);
+            if (i.v > 0) return "Offended " + translate_event_flags(i, ctx);
             return "";
         case 4:
-            switch(stored_event) {
+            switch(ctx.stored_event) {
                 case 16 : case 17 : case 18 : case 19 :
                     return simple_translate(FLAG,as_two.first) + " and " + simple_translate(FLAG,as_two.second);
                 case 48:
@@ -306,7 +331,7 @@ string translate_event(const PstLine & i) {
                 case 35: case 15: case 13: case 64:
                 case 5: case 40: case 68: case 10:
                 case 47: case 41: case 6 : case 3 : case 9:
-                    return simple_translate(CITYNAME, i.v);
+                    return translate_cityname(i.v, ctx);
                 case 69: case 39:
                     return (i.v < 0) ? "" : simple_translate(PURPOSE, i.v);
                 case 36:
@@ -314,7 +339,7 @@ string translate_event(const PstLine & i) {
                 case 38:
                     return simple_translate(SPECIALIST, i.v);
                 case 37:
-                    subevent = i.v; // Need to store this data if this is an upgrade.
+                    ctx.subevent = i.v; // Need to store this data if this is an upgrade.
                     // i.v > 20 only happens in unreal cases generated by -auto or manual splicing.
                     if (i.v > 20) { return simple_translate(BETTER_ITEM, i.v-20); }
                     return simple_translate(ITEM, i.v);
@@ -326,40 +351,41 @@ string translate_event(const PstLine & i) {
             }// end of _4
             break;
         case 5:
-            if (stored_event == 33 || stored_event == 21) { return simple_translate(FLAG, i.v); }
+            if (ctx.stored_event == 33 || ctx.stored_event == 21) { return simple_translate(FLAG, i.v); }
             break;
         case 8 :
-            switch(stored_event) {
+            switch(ctx.stored_event) {
                 case 33:
-                    return "Near " + simple_translate(CITYNAME, i.v);
+                    return "Near " + translate_cityname(i.v, ctx);
                 case 36:
-                    return (i.v > 0) ? "Governor encouraged plundering of " + translate_event_flags(i) : "";
+                    return (i.v > 0) ? "Governor encouraged plundering of " + translate_event_flags(i, ctx) : "";
                 case 37:
                     if (i.v == 1) {
-                        return "Upgrade to " + simple_translate(BETTER_ITEM, subevent);
+                        return "Upgrade to " + simple_translate(BETTER_ITEM, ctx.subevent);
                     } else { break;}
                 case 39: case 21: case 69:
-                    return simple_translate(CITYNAME, i.v);
+                    return translate_cityname(i.v, ctx);
                 case 44:
                     return "worth " + i.value + " gold";
                 case 47:
-                    if (subevent > 0) { return "--"; }
+                    if (ctx.subevent > 0) { return "--"; }
                     if (i.v >= 0) {
                         return "installed " + simple_translate(FLAG, i.v) + " governor";
                     } else { return  "declined to install governor"; }
                 case 66:
-                    return "headed for " + simple_translate(CITYNAME, i.v);
-                case 68:
+                    return "headed for " + translate_cityname(i.v, ctx);
+                case 68: {
                     // Is this a bug in the ordering of the evil characters in the perl script?
-                    temp_i = i.v;
+                    int temp_i = i.v;
                     if (temp_i == 40 || temp_i == 41) { temp_i = 81 - temp_i; }
                     if (temp_i == 0) { return ""; }
                     return simple_translate(PURPOSE, temp_i);
+                }
                 default: ;
             }
             break;
         case 9:
-            if (stored_event == 33) {
+            if (ctx.stored_event == 33) {
                 if (i.v >= 0) return simple_translate(PURPOSE, i.v);
                 return "";
             }
@@ -370,12 +396,12 @@ string translate_event(const PstLine & i) {
     return "";
 }
 
-string translate_city_by_linecode (const PstLine & i) {     // In this case, we aren't translating the value,
+string translate_city_by_linecode (const PstLine & i, DecodeContext & ctx) {     // In this case, we aren't translating the value,
     int index = index_from_linecode(i.line_code);           // but rather noting which cityname goes with this line_code index.
-    return simple_translate(CITYNAME, index);
+    return translate_cityname(index, ctx);
 }
 
-string translate_peace_and_war (const PstLine & i) {
+string translate_peace_and_war (const PstLine & i, DecodeContext &) {
     auto nation1 = index_from_linecode(i.line_code) - 16;
     if (nation1 < 0 || nation1 > 5) { return "";}
     auto nation2 = suffix_from_linecode(i.line_code) + 1;
@@ -386,12 +412,13 @@ string translate_peace_and_war (const PstLine & i) {
     return "";
 }
 
-string translate_date_and_age(const PstLine & i) {
-    string date = translate_date(i);
-    int age = stoi(regex_replace(date, regex(".* "), "")) - starting_year + 18;
-    return "Approx Date: " + translate_date(i) + "; Age: " + to_string(age);
+string translate_date_and_age(const PstLine & i, DecodeContext & ctx) {
+    string date = translate_date(i, ctx);
+    if (date == "") { return ""; }   // No date (0 or -1), so no age either.
+    int age = stoi(regex_replace(date, regex(".* "), "")) - ctx.starting_year + 18;
+    return "Approx Date: " + translate_date(i, ctx) + "; Age: " + to_string(age);
 }
-string translate_treasure_map(const PstLine & i) {
+string translate_treasure_map(const PstLine & i, DecodeContext &) {
     if (i.v==0 || i.v == -1) { return ""; }
     auto index = suffix_from_linecode(i.line_code);
     string retval = "feature";
@@ -400,7 +427,7 @@ string translate_treasure_map(const PstLine & i) {
     if (index & 16) { retval += " y coord "; } else { retval += " x coord "; }
     return retval;
 }
-string translate_ship_specialist (const PstLine & i) {
+string translate_ship_specialist (const PstLine & i, DecodeContext &) {
     // If a specialist is on board, then Ship_x_5_5 will be set to 10
     // and which specialist it is depends on the ship number.
     if (i.v != 10) { return ""; }
@@ -408,7 +435,7 @@ string translate_ship_specialist (const PstLine & i) {
     return simple_translate(SPECIALIST, index%8) + " on board";
 }
 
-string translate_beauty_and_shipwright(const PstLine & i) {
+string translate_beauty_and_shipwright(const PstLine & i, DecodeContext &) {
     int city_index = index_from_linecode(i.line_code);
     int city_value = (i.v+city_index)%8;
     string retval = "Shipwright can provide " + simple_translate(LONG_UPGRADES, city_value);
@@ -638,7 +665,7 @@ void augment_decoder_groups() {
     }
 }
 
-string translate_date(const PstLine & i) { // Translate the datestamp into a date in game time.
+string translate_date(const PstLine & i, DecodeContext & ctx) { // Translate the datestamp into a date in game time.
     if (i.v == -1) { return ""; }
     double stamp = (unsigned int)i.v;   // Leaving it negative would be more correct, but I'm matching perl here.
     if (stamp == 0 || stamp == -1) { return ""; }
@@ -652,46 +679,62 @@ string translate_date(const PstLine & i) { // Translate the datestamp into a dat
     time_t myt = stamp*24*3600/197.2;
     stringstream st;
     
-    st << std::put_time(std::gmtime(& myt), "%b %e, "); // month and day
+    std::tm tm_date;   // std::gmtime is not reentrant.
+#ifdef _WIN32
+    gmtime_s(& tm_date, & myt);
+#else
+    gmtime_r(& myt, & tm_date);
+#endif
+    st << std::put_time(& tm_date, "%b %e, "); // month and day
     string retval = regex_replace(st.str(), regex("  "), " ");
     
     st.str("");   // Clear the stream.
-    st << std::put_time(std::gmtime(& myt), "%Y\n");
+    st << std::put_time(& tm_date, "%Y\n");
     string syear = st.str();
-    int year = stoi(syear) - 1970 + starting_year;   // Changing the epoch
+    int year = stoi(syear) - 1970 + ctx.starting_year;   // Changing the epoch
     retval += to_string(year);
     
     return retval;
 }
 
-string PstLine::get_translation() {
-    for (string lc : lca) {  // lca = line_code_aliases.
+string PstLine::get_translation(DecodeContext & ctx) {
+    AllocScope scope(PHASE_TRANSLATE);
+    for (const string & lc : lca) {  // lca = line_code_aliases.
         if (line_decode.count(lc) && line_decode.at(lc).t != NIL) {
-            return translate(line_decode.at(lc).t, *this);
+            translatable t = line_decode.at(lc).t;
+            if (! ctx.stats) { return translate(t, *this, ctx); }
+            string translation = translate(t, *this, ctx);
+            ctx.stats->translation_calls[t]++;
+            if (translation.length() > 0) { ctx.stats->translation_hits[t]++; }
+            return translation;
         }
     }
     return "";
 }
 
-string PstLine::get_comment() {
-    for (string lc : lca) {
-        if (line_decode.count(lc) && line_decode.at(lc).comment.length() > 0) {
-            return line_decode.at(lc).comment;
+const string & PstLine::get_comment() const {
+    static const string no_comment = "";
+    for (const string & lc : lca) {
+        auto found = line_decode.find(lc);
+        if (found != line_decode.end() && found->second.comment.length() > 0) {
+            return found->second.comment;
         }
     }
-    return "";
+    return no_comment;
 }
 
 
-void check_for_specials(std::ifstream &in, std::ofstream &out,const string & line_code) {
+int read_starting_year(const PgReader &in, size_t personal_start) {
     // The savegame file has variable length parts at the beginning and end,
     // and a huge fixed length section in the middle. Once we hit the start of the fixed length section,
     // it makes sense to peek far ahead to read the starting year, so that it can be used in all of the datestamps.
+    constexpr int jump_dist = 887276;
+    return in.int_at(personal_start + jump_dist);
+}
+
+void check_for_specials(PgReader &in, PstWriter &out,const string & line_code, DecodeContext & ctx) {
     if (line_code == "Personal") {
-        constexpr int jump_dist = 887276;
-        in.seekg(jump_dist, ios_base::cur);
-        starting_year = read_int(in);
-        in.seekg(-jump_dist-4, ios_base::cur);
+        ctx.starting_year = read_starting_year(in, in.tellg());
     }
     // The perl code had an extra comment just before this section.
     if (line_code == "Log") {
@@ -699,18 +742,24 @@ void check_for_specials(std::ifstream &in, std::ofstream &out,const string & lin
     }
 }
 
-void print_field (std::ofstream &out, string value, int default_width) {
-    // Prints a field with appropriate spacing to keep the colons lined up for similar lines with different width values.
-    int lw = (int)value.length();
-    int width = default_width * ((lw/default_width)+1);
-    out << std::left << setw(width) << value << " : " ;
-}
-
-void PstLine::write_text(std::ofstream &out) {
+void PstLine::write_text(PstWriter &out, DecodeContext & ctx) {
+    AllocScope scope(PHASE_FORMAT);
     
-    string typecode =  char_for_meth[method] + to_string(bytes);
-    string comment =  get_comment();
-    string translation = get_translation();
+    // The typecode is short enough to build without allocating.
+    char typecode[16];
+    const string & meth = char_for_meth[method];
+    meth.copy(typecode, meth.length());
+    size_t typecode_length = to_chars(typecode + meth.length(), typecode + sizeof(typecode), bytes).ptr - typecode;
+    chrono::steady_clock::time_point start;
+    if (ctx.stats) { start = chrono::steady_clock::now(); }
+    const string & comment =  get_comment();
+    string translation = get_translation(ctx);
+    if (ctx.stats) {
+        auto translated = chrono::steady_clock::now();
+        ctx.stats->translate_time += translated - start;
+        start = translated;
+        ctx.stats->lines[method]++;
+    }
     
     // Perl script reports 4-byte integers as unsigned.
     // This is misleading, they act more like signed, so I am holding them
@@ -721,13 +770,13 @@ void PstLine::write_text(std::ofstream &out) {
     
     if (method==FEATURE) {
         // Spacing is different but simpler for F1 Feature case.
-        out << line_code << "  : " << typecode << " : " << value << " :";
+        out << line_code << "  : " << string(typecode, typecode_length) << " : " << value << " :";
         if (comment=="" && translation=="") { out << " "; }
         out << comment << translation << "\n";
     } else {
-        // Regular spacing method uses the print_field function to line up spaces.
-        print_field(out, line_code, 8);
-        print_field(out, typecode,  3);
+        // Regular spacing method uses the field function to line up spaces.
+        out.field(line_code, 8);
+        out.field(typecode, typecode_length, 3);
         
         int value_width = 1;
         if (method == TEXT) { value_width = 20; }
@@ -736,94 +785,51 @@ void PstLine::write_text(std::ofstream &out) {
                 value_width = 9;
             }
         }
-        print_field(out, value, value_width);
+        out.field(value, value_width);
         
         out << comment << translation << "\n";
     }
+    if (ctx.stats) { ctx.stats->format_time += chrono::steady_clock::now() - start; }
 }
 
-// Utilities?
-int read_int(ifstream & in) { // Read 4 bytes from in (little endian) and convert to integer
-    char b[4];
-    in.read((char*)&b, sizeof(b));
-    int B = (int)((unsigned char)(b[0]) |
-                  (unsigned char)(b[1]) << 8 |
-                  (unsigned char)(b[2]) << 16 |
-                  (char)(b[3]) << 24    );
-    return B;
-}
-
-
-void PstLine::read_binary_world_map(ifstream &in, std::vector<PstLine> & features) {
+void PstLine::read_binary_world_map(PgReader &in, std::vector<PstLine> & features) {
     // Reads a line of one of the world_map types. Extracts the features (totem pole, shipwreck, etc.)
     // and compresses the rest to make the map small enough to see in the pst file.
-    unsigned char b[600];
-    in.read((char*)&b, bytes);
-    
-    vector<bitset<4> > bs(bytes/4+1, 0);
+    const unsigned char * b = in.read(bytes);
     
-    const unsigned char sea = 0;
-    const unsigned char land    = method==CMAP ? 9 : (unsigned char)(-1);
-    const unsigned char max_sea = method==CMAP ? 4 : 0;
+    string compressed(compressed_map_size(bytes), '0');
+    vector<int> feature_columns;
+    {
+        TraceSpan span("compress_map_row");
+        compress_map_row(b, bytes, method, &compressed[0], feature_columns);
+    }
     
-    for (int i=0; i<bytes; i++) {
-        auto j = i/4;
-        auto k = i % 4;
-        
-        if (b[i]>max_sea) { bs.at(j)[3-k] = 1; }
-        
-        if (b[i] != sea && b[i] != land) {
-            // Located a feature. Add to the features vector for printing after the main map.
-            features.emplace_back(line_code + "_" + to_string(i), FEATURE, b[i],
-                string() + hexchar_for_int[b[i] >> 4] + hexchar_for_int[b[i] % 16], lca[1] + "_x");
-        }
+    for (int i : feature_columns) {
+        // Located a feature. Add to the features vector for printing after the main map.
+        features.emplace_back(line_code + "_" + to_string(i), FEATURE, b[i],
+            string() + hexchar_for_int[b[i] >> 4] + hexchar_for_int[b[i] % 16], lca[1] + "_x");
     }
-    // Now compressing the single bits of the map into hex for printing. SMAP would be all zeros, so it saves nothing.
+    // The single bits of the map are compressed into hex for printing. SMAP would be all zeros, so it saves nothing.
     if (method != SMAP) {
-        value = string(bytes/4+1, '0');
-        for (int j=0; j<bytes/4+1; j++) {
-            value[j] = hexchar_for_int[bs[j].to_ulong()];
-        }
+        value = compressed;
     }
     v = -2;    // Prevent MAP lines from being translated, even though FEATURE lines are.
 }
 
-void PstLine::expand_map_value() {
-    // This is the reverse of read_binary_world_map
-    // Take the compressed map (where one bit indicates sea or land)
-    // and expand it to a string that looks like BULK: 2 chars per byte of binary.
-    // The features will be added by update_map_value()
-    const string sea  = "00";
-    const string land = method==CMAP ? "09" : "ff";
-    stringstream ss;
-    stringstream bs;
-    
-    int compbytes = bytes/4;
-    if (bytes % 4) compbytes++;
-    
-    for (int b=0; b<compbytes; b++) {
-        char hexchar = method==SMAP ? '0' : value[b];                               // Read one character (or assume 0 for SMAP)
-        int intval = int_for_hexchar[hexchar];                                      // convert to int
-        std::bitset<4> asbits(intval);                                              // Convert to binary
-        for (int j=0; j<4; j++) {
-            if (asbits[3-j]) {                        // Now for each bit of the binary, write a byte
-                ss << land;
-            } else {
-                ss << sea;
-            }
-        }
+void PstLine::encode_map_row(unsigned char * out) const {
+    // This is the reverse of read_binary_world_map, without the features:
+    // take the compressed map (where one bit indicates sea or land) and expand it to bytes.
+    if (method == SMAP) {   // SMAP is all sea.
+        memset(out, map_bytes_for(SMAP).sea, bytes);
+        return;
     }
-    // Replace the compressed value in the PstLine with this expanded value.
-    value = ss.str();
+    if (value.length() < (bytes+3)/4)
+        throw invalid_argument("Compressed map too short: " + line_code);
+    if (! expand_map_row(value.data(), bytes, method, out))
+        throw invalid_argument("Compressed map is not hex: " + line_code);
 }
 
-void PstLine::update_map_value(const int column, const std::string & feature_value) {
-    if (! is_world_map(method))  throw logic_error("Cannot update_map_value on a non-map rmeth!");
-    if (value.length() < 293*2)  throw logic_error("Cannot update_map_value before expanding map value");
-    value.replace(column*2,2,feature_value);
-}
-
-void PstLine::read_binary(std::ifstream &in, std::vector<PstLine> & features) {
+void PstLine::read_binary(PgReader &in, std::vector<PstLine> & features) {
     if (is_world_map(method)) {
         this->read_binary_world_map(in, features);
         line_code += "_293";
@@ -833,37 +839,35 @@ void PstLine::read_binary(std::ifstream &in, std::vector<PstLine> & features) {
 }
 
 
-void PstLine::read_binary(std::ifstream &in) {
-    char b[2000] = "";
+void PstLine::read_binary(PgReader &in) {
+    constexpr int max_string_length = 1998;   // Sanity check on the string length int.
+    const unsigned char * b;
     stringstream ss;
     int size_of_string;
     switch (method) {
         case TEXT : // Reads the string length, then the string
-            size_of_string = read_int(in);
-            if (size_of_string > sizeof(b)-2) throw logic_error("expected string too long");
-            in.read((char *)& b, size_of_string);
-            value = b;
+            size_of_string = in.read_int();
+            if (size_of_string < 0 || size_of_string > max_string_length) throw logic_error("expected string too long");
+            b = in.read(size_of_string);
+            value = string((const char *)b, strnlen((const char *)b, size_of_string));  // Stops at a NUL, like a C string.
             if (bytes == 8) {
-                if (read_int(in) != 0) {} //throw logic_error("Unexpected non-zero after text8");
-                if (read_int(in) != 0) {} //throw logic_error("Unexpected non-zero after text8");
+                if (in.read_int() != 0) {} //throw logic_error("Unexpected non-zero after text8");
+                if (in.read_int() != 0) {} //throw logic_error("Unexpected non-zero after text8");
             }
             break;
         case BULK :
-            in.read((char*)&b, bytes);
-            // Old method, which was slower:
+            b = in.read(bytes);
+            // Old methods, which were slower:
             // ss << std::noshowbase << std::hex << nouppercase << setfill('0');
             // for (int i=0;i<bytes;i++) {
             //    ss << setw(2) << (int)(unsigned char)b[i];
             // }
+            // and then one hexchar_for_int lookup per nibble.
             value = string(bytes * 2, ' ');
-            for (int i = 0; i < bytes; ++i) {
-                value[2 * i]     = hexchar_for_int[(b[i] & 0xF0) >> 4];
-                value[2 * i + 1] = hexchar_for_int[ b[i] & 0x0F];
-            }
-           
+            hex_encode(b, bytes, &value[0]);
             break;
         case ZERO :
-            in.read((char*)&b, bytes);
+            b = in.read(bytes);
             for (int i=0;i<bytes;i++) {
                 if (b[i] != 0) throw logic_error("Non-zero found in expected zero-string");
             }
@@ -879,7 +883,7 @@ void PstLine::read_binary(std::ifstream &in) {
         case BINARY:
             if (bytes != standard_rmeth_size[method])
                 throw logic_error("Incorrect size request for fixed size number");
-            in.read((char*)&b, bytes);
+            b = in.read(bytes);
             for (int i=bytes-1; i>=0; i--) {
                 if (i<bytes-1) {
                     v = (v<<8) + (unsigned char)b[i];
@@ -922,7 +926,16 @@ void PstLine::read_binary(std::ifstream &in) {
     }
 }
 
-void PstLine::write_binary(std::ofstream & out) {
+size_t PstLine::binary_size() const {
+    switch (method) {
+        case FEATURE: return 0;                           // FEATURE does not write directly, it is used to edit the map lines.
+        case TEXT:    return 4 + value.length() + bytes;  // Length of string, the string, then padding.
+        default:      return bytes;
+    }
+}
+
+void PstLine::encode_binary(unsigned char * out) const {
+    // Encodes the value into binary_size() bytes at out.
     
     // For the numeric types, first convert to an unsigned int with a length.
     // This is also used by TEXT for the length-of-string int, and for HEX (which converts back to an int)
@@ -932,18 +945,24 @@ void PstLine::write_binary(std::ofstream & out) {
     switch (method) {
         case FEATURE: // FEATURE does not write directly, it is used to edit the map lines.
             return;
+        case ZERO:
+            memset(out, 0, bytes);
+            return;
         case HEX:   // For HEX, the byte order is reversed from the text. Also there are periods to skip.
             for (auto b=0; b<bytes; b++) {
-                out << (unsigned char)((int_for_hexchar[value[3*(bytes-b-1)]] << 4) + (int_for_hexchar[value[3*(bytes-b-1)+1]]));
+                out[b] = (unsigned char)((int_for_hexchar[value[3*(bytes-b-1)]] << 4) + (int_for_hexchar[value[3*(bytes-b-1)+1]]));
             }
             return;
-        case BULK : // Read the hex 2 characters at a time to write one byte.
-        case SMAP : // The three worldmaps have been expanded so they look like BULK.
+        case SMAP : // The three worldmaps expand from their compressed form. The features are added separately.
         case CMAP :
         case FMAP :
-            for (auto b=0; b<bytes; b++) {
-                out << (unsigned char)((int_for_hexchar[value[2*b]] << 4) + (int_for_hexchar[value[2*b+1]]));
-            }
+            encode_map_row(out);
+            return;
+        case BULK : // Read the hex 2 characters at a time to write one byte.
+            if (value.length() < 2*bytes)
+                throw invalid_argument("Value too short for " + to_string(bytes) + " bytes: " + line_code);
+            if (! hex_decode(value.data(), bytes, out))
+                throw invalid_argument("Value is not hex: " + line_code);
             return;
             // Cases below end with break rather than return, because they have a two part write.
         case TEXT:
@@ -967,22 +986,19 @@ void PstLine::write_binary(std::ofstream & out) {
         case BINARY:
             data = (unsigned int)stoul(value,nullptr,2);
             break;
-        case ZERO:
         default:
             data = 0;
     }
     
     // Now send the numeric data out in binary form.
     for (auto b=0;b<bytes_to_write;b++) {
-        out << (unsigned char)(data % 256);
+        *out++ = (unsigned char)(data % 256);
         data = data >> 8;
     }
       
     // For TEXT, we have only sent the length so far, so now send the actual text, followed by padding if necessary.
     if (method == TEXT) {
-        out << value;
-        for (auto b=0; b<bytes; b++) {
-            out << (char)0;
-        }
+        out = copy(value.begin(), value.end(), out);
+        fill(out, out + bytes, 0);
     }
 }
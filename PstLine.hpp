@@ -13,8 +13,23 @@
 #include <string>
 #include "RMeth.hpp"
 #include "PstSection.hpp"
+#include "PstWriter.hpp"
+#include "PstStats.hpp"
 #include <array>
 
+// All of the state carried from one line to the next while decoding a single savegame.
+// Each unpack has its own DecodeContext, so several savegames can be decoded at the same time.
+struct DecodeContext {
+    int starting_year = 0;
+    int stored_event = 0;   // Events in the log file are spread across 8 lines
+    int subevent = 0;       // and I need a little bit of state to decode the later lines.
+    std::vector<std::string> citynames = std::vector<std::string>(128);   // Loaded during the reading of the CityName section
+    std::vector<int> stored_city_wealth = std::vector<int>(128);          // Needed later to describe the population
+    std::string last_flag = "";   // ship_names depend on the nationality
+    int last_shiptype = 0;        // and the type of the ship.
+    SectionStats * stats = nullptr;   // Only set with -stats
+};
+
 class PstLine {
 public:
     std::string line_code;
@@ -24,55 +39,57 @@ public:
     int bytes = standard_rmeth_size[method];
     std::array<std::string, 3> lca;   // line_code_aliases
     
-    PstLine(PstSection subsection) : line_code(subsection.name), method(subsection.splits.front().method), bytes(subsection.splits.front().bytes), lca(subsection.lca) {}
+    PstLine(const PstPlanLine & plan_line) : line_code(plan_line.line_code), method(plan_line.method), bytes(plan_line.bytes), lca(plan_line.lca) {}
     PstLine(std::string lc, rmeth rm, int v,     std::string value, std::string al) : line_code(lc), method(rm), v(v),         value(value), lca{al} { lca[0] = al; }
     PstLine(std::string lc, rmeth rm, int bytes, std::string value)                 : line_code(lc), method(rm), bytes(bytes), value(value) {}
     PstLine(const PstLine & pl2) = default;
     PstLine() {}
-    void read_binary (std::ifstream &in, std::vector<PstLine> & features);
-    void read_binary_world_map (std::ifstream &in, std::vector<PstLine> & features);
-    void read_binary (std::ifstream &in);
-    void write_text (std::ofstream &out);
-    void write_binary (std::ofstream &out);
-    void expand_map_value();
-    void update_map_value(const int column, const std::string & value);
-    std::string get_comment();
-    std::string get_translation();
+    void read_binary (PgReader &in, std::vector<PstLine> & features);
+    void read_binary_world_map (PgReader &in, std::vector<PstLine> & features);
+    void read_binary (PgReader &in);
+    void write_text (PstWriter &out, DecodeContext & ctx);
+    size_t binary_size() const;
+    void encode_binary (unsigned char * out) const;
+    void encode_map_row (unsigned char * out) const;
+    const std::string & get_comment() const;
+    std::string get_translation(DecodeContext & ctx);
 };
 
-
-int read_int(std::ifstream & in);
 enum translatable : char;
 
 // Public routines
-void check_for_specials(std::ifstream &in, std::ofstream &out,const std::string & line_code);
+void check_for_specials(PgReader &in, PstWriter &out,const std::string & line_code, DecodeContext & ctx);
+int read_starting_year(const PgReader &in, size_t personal_start);
 void augment_decoder_groups();
+const char * translatable_name(int t);   // For the -stats report
 
 // Utilities?
 int index_from_linecode  (const std::string &);
 int suffix_from_linecode (const std::string &);
 
 // Stubs for routines called by get_translation
-std::string translate(const translatable t, const PstLine &);
+std::string translate(const translatable t, const PstLine &, DecodeContext &);
 std::string simple_translate (const translatable t, const int as_int);
-std::string translate_soldiers(const PstLine &) ;
-std::string translate_acres(const PstLine &) ;
-std::string translate_luxuries_and_spices(const PstLine &) ;
-std::string translate_population(const PstLine &) ;
-std::string translate_following(const PstLine &) ;
-std::string store_cityname (const PstLine &) ;
-std::string store_flag(const PstLine &);
-std::string translate_wealth(const PstLine &) ;
-std::string translate_population_type (const PstLine &) ;
-std::string translate_event_flags(const PstLine &) ;
-std::string translate_event(const PstLine &) ;
-std::string translate_city_by_linecode (const PstLine &) ;
-std::string translate_ship_specialist (const PstLine &) ;
-std::string translate_beauty_and_shipwright(const PstLine &) ;
-std::string translate_date(const PstLine &) ;
-std::string translate_date_and_age(const PstLine &) ;
-std::string translate_peace_and_war(const PstLine &) ;
-std::string translate_treasure_map(const PstLine &) ;
-std::string translate_pirate_hangout(const PstLine &);
+std::string translate_cityname (const int index, const DecodeContext &);
+std::string translate_soldiers(const PstLine &, DecodeContext &);
+std::string translate_acres(const PstLine &, DecodeContext &);
+std::string translate_luxuries_and_spices(const PstLine &, DecodeContext &);
+std::string translate_population(const PstLine &, DecodeContext &);
+std::string translate_following(const PstLine &, DecodeContext &);
+std::string store_cityname (const PstLine &, DecodeContext &);
+std::string translate_cityname_value (const PstLine &, DecodeContext &);
+std::string store_flag(const PstLine &, DecodeContext &);
+std::string translate_wealth(const PstLine &, DecodeContext &);
+std::string translate_population_type (const PstLine &, DecodeContext &);
+std::string translate_event_flags(const PstLine &, DecodeContext &);
+std::string translate_event(const PstLine &, DecodeContext &);
+std::string translate_city_by_linecode (const PstLine &, DecodeContext &);
+std::string translate_ship_specialist (const PstLine &, DecodeContext &);
+std::string translate_beauty_and_shipwright(const PstLine &, DecodeContext &);
+std::string translate_date(const PstLine &, DecodeContext &);
+std::string translate_date_and_age(const PstLine &, DecodeContext &);
+std::string translate_peace_and_war(const PstLine &, DecodeContext &);
+std::string translate_treasure_map(const PstLine &, DecodeContext &);
+std::string translate_pirate_hangout(const PstLine &, DecodeContext &);
 
 #endif /* PstLine_hpp */
@@ -14,9 +14,17 @@
 #include <string>
 #include <regex>
 #include <iostream>
+#include <thread>
+#include <atomic>
+#include <numeric>
+#include <algorithm>
+#include <exception>
+#include <chrono>
 #include "PstSection.hpp"
 #include "PstLine.hpp"
 #include "RMeth.hpp"
+#include "Trace.hpp"
+#include "AllocCounter.hpp"
 using namespace std;
 
 
@@ -141,28 +149,248 @@ unordered_map<string,list<PstSplit>> subsection_manual_decode = {
     {"Top10_x_1",     {{BINARY}, {ZERO,3}}},      // 4 = 1+3
 };
 
-void unpackPst(ifstream & in, ofstream & out) {
-    try {
-        for (auto section : section_vector) {
-            out << "## " << section.name << " starts at byte " << in.tellg() << "\n";
-            check_for_specials(in, out, section.name);
-            section.unpack(in, out);
+static vector<PstPlanLine> compiled_plan;
+static vector<size_t> compiled_plan_sections;
+static unordered_map<string, int> compiled_plan_index;
+static unordered_map<string, vector<int>> compiled_alias_index;
+const vector<PstPlanLine> & decode_plan = compiled_plan;
+const vector<size_t> & decode_plan_sections = compiled_plan_sections;
+
+void compile_decode_plan() {
+    // Expand every section into its lines once, so that unpackPst does not need to
+    // rebuild the subsections and probe the subsection maps for every file.
+    compiled_plan.clear();
+    compiled_plan_sections.clear();
+    for (int s=0; s<section_vector.size(); s++) {
+        compiled_plan_sections.push_back(compiled_plan.size());
+        int offset = 0;
+        PstSection(section_vector[s]).compile(s, offset);
+    }
+    compiled_plan_sections.push_back(compiled_plan.size());
+    
+    // The index uses the line_code as it appears in the pst file, where the world map rows have _293 added.
+    compiled_plan_index.clear();
+    compiled_plan_index.reserve(compiled_plan.size());
+    for (int i=0; i<compiled_plan.size(); i++) {
+        const PstPlanLine & line = compiled_plan[i];
+        compiled_plan_index.emplace(is_world_map(line.method) ? line.line_code + "_293" : line.line_code, i);
+    }
+    compiled_alias_index.clear();
+    for (int i=0; i<compiled_plan.size(); i++) {
+        for (int a=1; a<3; a++) {
+            if (compiled_plan[i].lca[a].length() > 0) {
+                compiled_alias_index[compiled_plan[i].lca[a]].push_back(i);
+            }
         }
+    }
+}
+
+int plan_index_for(const std::string & line_code) {
+    auto found = compiled_plan_index.find(line_code);
+    return found == compiled_plan_index.end() ? -1 : found->second;
+}
+
+const std::vector<int> & plan_indices_for_alias(const std::string & alias) {
+    static const vector<int> none;
+    auto found = compiled_alias_index.find(alias);
+    return found == compiled_alias_index.end() ? none : found->second;
+}
+
+static void unpack_section(PgReader & in, PstWriter & out, int s, DecodeContext & ctx, FileStats * stats) {
+    // Unpack a section by printing each line in the decode plan, then any features that were collected.
+    // Features are only collected from the direct children of a section whose rmeth is_world_map.
+    TraceSpan span(section_vector[s].name.c_str(), "unpack section");
+    AllocScope scope(PHASE_DECODE);
+    SectionStats * section_stats = ctx.stats = stats ? &stats->sections[s] : nullptr;
+    size_t section_start = in.tellg();
+    chrono::steady_clock::time_point start;
+    chrono::nanoseconds text_time_before{0};
+    if (section_stats) {
+        start = chrono::steady_clock::now();
+        text_time_before = section_stats->translate_time + section_stats->format_time;
+    }
+    
+    const string & name = section_vector[s].name;
+    out << "## " << name << " starts at byte " << in.tellg() << '\n';
+    check_for_specials(in, out, name, ctx);
+    vector<PstLine> features;
+    for (auto i=decode_plan_sections[s]; i<decode_plan_sections[s+1]; i++) {
+        auto aline = PstLine(decode_plan[i]);
+        aline.read_binary(in, features);
+        aline.write_text(out, ctx);
+    }
+    // world_map sections accumulate features, which we print after the map.
+    for (auto && feature : features) {
+        feature.write_text(out, ctx);
+    }
+    
+    if (section_stats) {   // Whatever time was not spent on the text went to reading the binary.
+        auto text_time = section_stats->translate_time + section_stats->format_time - text_time_before;
+        section_stats->decode_time += chrono::steady_clock::now() - start - text_time;
+        section_stats->bytes_decoded += in.tellg() - section_start;
+        section_stats->features += features.size();
+    }
+    ctx.stats = nullptr;
+}
+
+static void unpack_sequential(PgReader & in, PstWriter & out, FileStats * stats) {
+    DecodeContext ctx;
+    for (int s=0; s<section_vector.size(); s++) {
+        unpack_section(in, out, s, ctx, stats);
+    }
+}
+
+// The only facts carried from one section into later ones (apart from the starting year) are the ones
+// stored by the translations in these sections: the city names and the city wealth.
+static const vector<string> fact_sections = {"CityName", "City"};
+
+static int section_index(const string & name) {
+    for (int s=0; s<section_vector.size(); s++) {
+        if (section_vector[s].name == name) { return s; }
+    }
+    throw logic_error("No section named " + name);
+}
+
+static vector<size_t> find_section_starts(const PgReader & in) {
+    // Section sizes are fixed, except where there are TEXT lines, whose string lengths have to be read.
+    // Returns the start of each section, plus the end of the last one.
+    vector<size_t> starts;
+    size_t pos = in.tellg();
+    for (int s=0; s<section_vector.size(); s++) {
+        starts.push_back(pos);
+        for (auto i=decode_plan_sections[s]; i<decode_plan_sections[s+1]; i++) {
+            auto & plan_line = decode_plan[i];
+            if (plan_line.method == TEXT) {
+                int size_of_string = in.int_at(pos);
+                if (size_of_string < 0) throw logic_error("expected string too long");
+                pos += 4 + size_of_string;
+            }
+            pos += plan_line.bytes;
+        }
+    }
+    starts.push_back(pos);
+    return starts;
+}
+
+static DecodeContext prepass_decode_context(const PgReader & in, const vector<size_t> & starts) {
+    // Decode (but do not print) the fact_sections, to get the context that every section can start from.
+    AllocScope scope(PHASE_DECODE);
+    DecodeContext facts;
+    facts.starting_year = read_starting_year(in, starts[section_index("Personal")]);
+    DecodeContext scratch;
+    for (auto && name : fact_sections) {
+        int s = section_index(name);
+        auto section_in = in.at(starts[s]);
+        for (auto i=decode_plan_sections[s]; i<decode_plan_sections[s+1]; i++) {
+            auto aline = PstLine(decode_plan[i]);
+            aline.read_binary(section_in);
+            aline.get_translation(scratch);
+        }
+    }
+    facts.citynames = scratch.citynames;
+    facts.stored_city_wealth = scratch.stored_city_wealth;
+    return facts;
+}
+
+static void unpack_parallel(PgReader & in, PstWriter & out, int thread_count, FileStats * stats) {
+    // Same output as unpack_sequential, but after a quick prepass to find the section starts and the facts
+    // that are carried between sections, the sections are decoded on separate threads into their own buffers.
+    vector<size_t> starts;
+    DecodeContext facts;
+    {
+        TraceSpan span("prepass");
+        starts = find_section_starts(in);
+        facts = prepass_decode_context(in, starts);
+    }
+    
+    auto section_count = section_vector.size();
+    vector<string> buffers(section_count);
+    vector<exception_ptr> errors(section_count);
+    
+    // Hand out the biggest sections first, so that the map sections do not end up at the back of the queue.
+    vector<int> order(section_count);
+    iota(order.begin(), order.end(), 0);
+    stable_sort(order.begin(), order.end(), [&](int a, int b) {
+        return decode_plan_sections[a+1] - decode_plan_sections[a] > decode_plan_sections[b+1] - decode_plan_sections[b];
+    });
+    atomic<size_t> next_section{0};
+    auto worker = [&]() {
+        for (size_t n = next_section++; n < section_count; n = next_section++) {
+            int s = order[n];
+            PstWriter section_out;
+            try {
+                DecodeContext ctx = facts;
+                auto section_in = in.at(starts[s]);
+                unpack_section(section_in, section_out, s, ctx, stats);   // Each section has its own stats, so this is thread safe.
+                if (section_in.tellg() != starts[s+1])
+                    throw logic_error("Section " + section_vector[s].name + " did not end at byte " + to_string(starts[s+1]));
+            } catch (...) {
+                errors[s] = current_exception();
+            }
+            buffers[s] = section_out.release();
+        }
+    };
+    vector<thread> threads;
+    for (int t=1; t<thread_count; t++) { threads.emplace_back(worker); }
+    worker();
+    for (auto && t : threads) { t.join(); }
+    
+    for (int s=0; s<section_count; s++) {
+        out << buffers[s];
+        if (errors[s]) { rethrow_exception(errors[s]); }
+    }
+    in.seek(starts.back());
+}
+
+static void write_timed(const PstWriter & pst, ostream & out, FileStats * stats) {
+    auto start = chrono::steady_clock::now();
+    pst.write_to(out);
+    if (stats) { stats->write_time += chrono::steady_clock::now() - start; }
+}
+
+void unpackPst(PgReader & in, ostream & out, FileStats * stats) {
+    // The pst text is built up in memory, and written out in one go.
+    PstWriter pst;
+    try {
+        unpack_sequential(in, pst, stats);
+        write_timed(pst, out, stats);
+    } catch (logic_error & e) {   // For debug, helps a lot to close out before aborting.
+        pst.write_to(out);
+        out.flush();
+        cerr << e.what();
+        abort();
+    }
+}
+
+void unpackPst_parallel(PgReader & in, ostream & out, int thread_count, FileStats * stats) {
+    PstWriter pst;
+    try {
+        unpack_parallel(in, pst, thread_count, stats);
+        write_timed(pst, out, stats);
     } catch (logic_error & e) {   // For debug, helps a lot to close out before aborting.
-        out.close();
+        pst.write_to(out);
+        out.flush();
         cerr << e.what();
         abort();
     }
 }
 
-void PstSection::unpack (ifstream & in, ofstream & out) {
+std::string unpack_pst_text(PgReader & in, int thread_count, FileStats * stats) {
+    PstWriter pst;
+    if (thread_count > 1) {
+        unpack_parallel(in, pst, thread_count, stats);
+    } else {
+        unpack_sequential(in, pst, stats);
+    }
+    return pst.release();
+}
+
+void PstSection::compile(int section_index, int & offset) {
     
-    // Unpack a section by printing each of the subsections that it is broken into, then any features that were collected.
-    // Features are only collected from the direct child of a parent section whose rmeth is_world_map.
-    int offset = 0;
-    vector<PstLine> features;
+    // Add a section to the decode plan by adding each of the subsections that it is broken into.
+    int c_offset = 0;
     for (auto split : splits) {  // A PstSection has a list of splits, each of which could have a count.
-        for (int c=offset; c<split.count+offset;c++) {
+        for (int c=c_offset; c<split.count+c_offset;c++) {
             
             PstSection subsection{*this, c, split};
             bool subsection_is_actually_single_line = true;  // We'll find out.
@@ -175,7 +403,7 @@ void PstSection::unpack (ifstream & in, ofstream & out) {
                 }
                 
                 if (subsection_simple_decode.count(line_code_alias)) {
-                    // Instead of printing this line, we split it, by calling unpack_section recursively.
+                    // Instead of adding this line, we split it, by calling compile recursively.
                     subsection_is_actually_single_line = false;
                     
                     // For subsection_simple_decode, we have to calculate how many pieces to split it into
@@ -188,12 +416,12 @@ void PstSection::unpack (ifstream & in, ofstream & out) {
                     }
                     
                     subsection.splits = { PstSplit{submeth, standard_rmeth_size[submeth], how_many_pieces} };
-                    subsection.unpack(in, out);
+                    subsection.compile(section_index, offset);
                     break;  // No need to check further in the lca.
                 }
                 
                 if (subsection_manual_decode.count(line_code_alias))  {
-                    // Instead of printing this line, we split it, by calling unpack_section recursively, but the splits have been done manually.
+                    // Instead of adding this line, we split it, by calling compile recursively, but the splits have been done manually.
                     subsection_is_actually_single_line = false;
                     auto new_splits = subsection_manual_decode.at(line_code_alias);
                     
@@ -204,22 +432,17 @@ void PstSection::unpack (ifstream & in, ofstream & out) {
                         throw logic_error("Error decoding line " + subsection.name + " subsections don't add up: " + to_string(byte_count_check) + " != " + to_string(split.bytes));
 
                     subsection.splits = new_splits;
-                    subsection.unpack(in, out);
+                    subsection.compile(section_index, offset);
                     break; // No need to check further in the lca.
                 }
             }
             
             if (subsection_is_actually_single_line) {
-                auto aline = PstLine(subsection);
-                aline.read_binary(in, features);
-                aline.write_text(out);
+                auto & line_split = subsection.splits.front();
+                compiled_plan.push_back({subsection.name, subsection.lca, line_split.method, line_split.bytes, section_index, offset});
+                offset += (line_split.method == TEXT) ? 4 + line_split.bytes : line_split.bytes;  // TEXT has a length int before the string.
             }
         }
-        offset += split.count;
-    }
-    // world_map sections accumulate features, which we print after the map.
-    for (auto feature : features) {
-        feature.write_text(out);
+        c_offset += split.count;
     }
 }
-
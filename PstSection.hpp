@@ -10,12 +10,20 @@
 #define PstSection_hpp
 
 #include <fstream>
+#include <ostream>
 #include <string>
 #include <list>
 #include <array>
+#include <vector>
 #include "RMeth.hpp"
+#include "PgReader.hpp"
 
-void unpackPst(std::ifstream & in, std::ofstream & out);
+struct FileStats;
+// Each takes an optional FileStats to fill in for -stats.
+void unpackPst(PgReader & in, std::ostream & out, FileStats * stats = nullptr);
+void unpackPst_parallel(PgReader & in, std::ostream & out, int thread_count, FileStats * stats = nullptr);
+std::string unpack_pst_text(PgReader & in, int thread_count, FileStats * stats = nullptr);   // Like unpackPst, but throws instead of aborting.
+void compile_decode_plan();
 int index_from_linecode (const std::string & line_code);
 
 struct PstSplit {
@@ -50,8 +58,24 @@ public:
             }
         }
     };
-    void unpack(std::ifstream & in, std::ofstream & out);
+    void compile(int section_index, int & offset);
 };
 extern const std::vector<PstSection> section_vector;
 
+// The decode plan is the section_vector with all of the subsection maps applied, flattened into
+// one PstPlanLine per line of the pst file, in file order. It is compiled once by compile_decode_plan(),
+// so unpacking a file is just a walk down this table.
+struct PstPlanLine {
+    std::string line_code;            // Full line_code, like Ship_23_0_2
+    std::array<std::string, 3> lca;   // line_code_aliases
+    rmeth method;
+    int bytes;
+    int section;                      // Index into section_vector
+    int offset;                       // Bytes from the start of the section, counting only the fixed part of TEXT lines
+};
+extern const std::vector<PstPlanLine> & decode_plan;
+extern const std::vector<size_t> & decode_plan_sections;  // First plan line of each section, plus the end of the plan.
+int plan_index_for(const std::string & line_code);         // Index into decode_plan for a pst line_code, or -1 if it is not in the plan.
+const std::vector<int> & plan_indices_for_alias(const std::string & alias);  // All plan lines with an alias like Ship_x_0_2
+
 #endif /* PstSection_hpp */
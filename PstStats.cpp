@@ -0,0 +1,130 @@
+//
+//  PstStats.cpp
+//  pirates_savegame_editor
+//
+
+#include "PstStats.hpp"
+#include "PstSection.hpp"
+#include "PstLine.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+using namespace std;
+
+void SectionStats::add(const SectionStats & other) {
+    bytes_decoded += other.bytes_decoded;
+    bytes_encoded += other.bytes_encoded;
+    for (size_t m=0; m<lines.size(); m++) { lines[m] += other.lines[m]; }
+    features += other.features;
+    for (int t=0; t<translatable_slots; t++) {
+        translation_calls[t] += other.translation_calls[t];
+        translation_hits[t]  += other.translation_hits[t];
+    }
+    decode_time    += other.decode_time;
+    translate_time += other.translate_time;
+    format_time    += other.format_time;
+}
+
+FileStats::FileStats(std::string f, std::string op) : file(f), operation(op), sections(section_vector.size()) {}
+
+SectionStats FileStats::total() const {
+    SectionStats sum;
+    for (auto && section : sections) { sum.add(section); }
+    return sum;
+}
+
+static string ms(chrono::nanoseconds t) {
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%.2f", t.count() / 1e6);
+    return buffer;
+}
+
+static size_t line_count(const SectionStats & s) {
+    size_t count = 0;
+    for (auto n : s.lines) { count += n; }
+    return count;
+}
+
+static void print_row(const string & name, const SectionStats & s) {
+    char buffer[160];
+    snprintf(buffer, sizeof(buffer), "  %-14s %10zu %10zu %8zu %8zu %10s %10s %10s\n", name.c_str(),
+             s.bytes_decoded, s.bytes_encoded, line_count(s), s.features,
+             ms(s.decode_time).c_str(), ms(s.translate_time).c_str(), ms(s.format_time).c_str());
+    cout << buffer;
+}
+
+static void print_details(const SectionStats & total) {
+    cout << "  Lines by rmeth:";
+    for (int m=0; m<=FEATURE; m++) {
+        if (total.lines[m]) { cout << " " << name_for_meth[m] << " " << total.lines[m]; }
+    }
+    cout << "\n";
+    bool any = false;
+    for (int t=0; t<translatable_slots; t++) {
+        if (total.translation_calls[t] == 0) continue;
+        if (! any) { cout << "  Translations (hits/calls):"; any = true; }
+        cout << " " << translatable_name(t) << " " << total.translation_hits[t] << "/" << total.translation_calls[t];
+    }
+    if (any) { cout << "\n"; }
+}
+
+namespace {
+struct FileSummary {
+    string file;
+    size_t features;
+    chrono::nanoseconds time;
+};
+}
+static mutex stats_mutex;
+static SectionStats all_files;
+static chrono::nanoseconds all_io{0};
+static vector<FileSummary> file_summaries;
+
+void report_stats(const FileStats & stats) {
+    auto total = stats.total();
+    auto io = stats.read_time + stats.write_time;
+    auto time = io + stats.parse_time + stats.encode_time + total.decode_time + total.translate_time + total.format_time;
+
+    lock_guard<mutex> lock(stats_mutex);
+    cout << "Stats for " << stats.operation << " " << stats.file << "\n";
+    cout << "  section          bytes in  bytes out    lines features  decode ms  transl ms  format ms\n";
+    for (size_t s=0; s<stats.sections.size(); s++) {
+        if (line_count(stats.sections[s]) == 0 && stats.sections[s].bytes_decoded == 0) continue;
+        print_row(section_vector[s].name, stats.sections[s]);
+    }
+    print_row("total", total);
+    print_details(total);
+    cout << "  I/O: read " << ms(stats.read_time) << " ms, write " << ms(stats.write_time) << " ms";
+    if (stats.parse_time.count() || stats.encode_time.count()) {
+        cout << ". Packing: parse " << ms(stats.parse_time) << " ms, encode " << ms(stats.encode_time) << " ms";
+    }
+    cout << ". Total " << ms(time) << " ms\n";
+
+    all_files.add(total);
+    all_io += io;
+    file_summaries.push_back({stats.file, total.features, time});
+}
+
+void report_stats_summary() {
+    lock_guard<mutex> lock(stats_mutex);
+    if (file_summaries.size() < 2) return;
+    cout << "Stats for all " << file_summaries.size() << " files\n";
+    print_row("total", all_files);
+    print_details(all_files);
+    cout << "  I/O: " << ms(all_io) << " ms\n";
+
+    // The outliers are what the stats are for: savegames that are slow, or have an unusual number of features.
+    constexpr size_t shown = 3;
+    auto top = [&](const char * title, auto key, auto show) {
+        vector<FileSummary> sorted = file_summaries;
+        stable_sort(sorted.begin(), sorted.end(), [&](const FileSummary & a, const FileSummary & b) { return key(a) > key(b); });
+        cout << "  " << title << ":";
+        for (size_t i=0; i<min(shown, sorted.size()); i++) { cout << " " << sorted[i].file << " (" << show(sorted[i]) << ")"; }
+        cout << "\n";
+    };
+    top("Most features", [](const FileSummary & f) { return f.features; }, [](const FileSummary & f) { return to_string(f.features); });
+    top("Slowest", [](const FileSummary & f) { return f.time; }, [](const FileSummary & f) { return ms(f.time) + " ms"; });
+}
@@ -0,0 +1,56 @@
+//
+//  PstStats.hpp
+//  pirates_savegame_editor
+//
+
+#ifndef PstStats_hpp
+#define PstStats_hpp
+
+#include <array>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "RMeth.hpp"
+
+// Counters for -stats. The routines that fill them are handed a pointer, which is null without -stats,
+// so a normal run only pays for checking that pointer. Nothing here is shared between threads:
+// each section of each file has its own SectionStats.
+
+constexpr int translatable_slots = 64;   // Room for every translatable enum.
+
+struct SectionStats {
+    size_t bytes_decoded = 0;
+    size_t bytes_encoded = 0;
+    std::array<size_t, FEATURE+1> lines{};   // pst lines, by rmeth
+    size_t features = 0;                     // FEATURE lines found in (or put back into) the world maps
+    std::array<size_t, translatable_slots> translation_calls{};
+    std::array<size_t, translatable_slots> translation_hits{};   // Calls that gave a non-empty translation
+    std::chrono::nanoseconds decode_time{0};      // Reading the binary, outside of the two below
+    std::chrono::nanoseconds translate_time{0};   // get_translation and get_comment
+    std::chrono::nanoseconds format_time{0};      // Lining up the pst text
+
+    void add(const SectionStats & other);
+};
+
+struct FileStats {
+    std::string file;
+    std::string operation;                  // unpack, pack, or test
+    std::vector<SectionStats> sections;     // One per section_vector entry
+    std::chrono::nanoseconds read_time{0};  // I/O, which for a memory mapped savegame is mostly just opening it
+    std::chrono::nanoseconds write_time{0};
+    std::chrono::nanoseconds parse_time{0};   // pst text into values, when packing
+    std::chrono::nanoseconds encode_time{0};  // values into the savegame image, when packing
+
+    FileStats(std::string file, std::string operation);
+    SectionStats total() const;
+};
+
+extern bool collect_stats;   // Set by -stats
+
+// Prints the stats for one file and adds them to the totals. Safe to call from several threads.
+void report_stats(const FileStats & stats);
+
+// After a batch, prints the totals and the files that stood out.
+void report_stats_summary();
+
+#endif /* PstStats_hpp */
@@ -0,0 +1,28 @@
+//
+//  PstWriter.cpp
+//  pirates_savegame_editor
+//
+
+#include "PstWriter.hpp"
+#include <charconv>
+
+static const std::string padding(64, ' ');
+
+PstWriter & PstWriter::operator<<(size_t n) {
+    char digits[24];
+    auto result = std::to_chars(digits, digits + sizeof(digits), n);
+    text.append(digits, result.ptr - digits);
+    return *this;
+}
+
+void PstWriter::field(const char * s, size_t length, int default_width) {
+    // Same spacing as std::left << setw(width) with the width rounded up to the next multiple of default_width.
+    size_t width = default_width * ((length/default_width)+1);
+    text.append(s, length);
+    for (size_t pad = width - length; pad > 0; ) {
+        size_t n = pad < padding.size() ? pad : padding.size();
+        text.append(padding, 0, n);
+        pad -= n;
+    }
+    text.append(" : ", 3);
+}
@@ -0,0 +1,36 @@
+//
+//  PstWriter.hpp
+//  pirates_savegame_editor
+//
+
+#ifndef PstWriter_hpp
+#define PstWriter_hpp
+
+#include <string>
+#include <ostream>
+
+// PstWriter builds up the text of a pst file in one growing buffer, which is written out all at once.
+// It replaces ostream formatting with setw, which was most of the cost of writing a pst file.
+
+class PstWriter {
+public:
+    PstWriter & operator<<(const std::string & s) { text.append(s); return *this; }
+    PstWriter & operator<<(const char * s)        { text.append(s); return *this; }
+    PstWriter & operator<<(char c)                { text.push_back(c); return *this; }
+    PstWriter & operator<<(size_t n);
+    
+    // Writes a field padded with spaces to keep the colons lined up for similar lines with different width values,
+    // followed by the " : " separator.
+    void field(const char * s, size_t length, int default_width);
+    void field(const std::string & s, int default_width) { field(s.data(), s.length(), default_width); }
+    
+    void reserve(size_t n) { text.reserve(n); }
+    const std::string & str() const { return text; }
+    std::string release() { return std::move(text); }
+    void write_to(std::ostream & out) const { out.write(text.data(), text.size()); }
+    
+private:
+    std::string text;
+};
+
+#endif /* PstWriter_hpp */
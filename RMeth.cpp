@@ -13,6 +13,7 @@ using namespace std;
 //enum rmeth : char               {TEXT, HEX, INT, BINARY, SHORT, CHAR, LCHAR, mFLOAT, uFLOAT, FMAP, SMAP, CMAP, BULK, ZERO, FEATURE };
 const int standard_rmeth_size[] = { 0,    4,   4,   1,      2,     1,    1,     4,      4,      0,    0,    0,    4,    0,    1       };
 const std::string char_for_meth[]={"t",  "h", "V", "B",    "s",   "C",  "c",   "g",    "G",    "M",  "m",  "MM", "H",  "x",  "F"      };
+const std::string name_for_meth[]={"TEXT","HEX","INT","BINARY","SHORT","CHAR","LCHAR","mFLOAT","uFLOAT","FMAP","SMAP","CMAP","BULK","ZERO","FEATURE"};
 
 rmeth meth_for_most_char[256];
 void set_up_rmeth() {
@@ -22,7 +23,7 @@ void set_up_rmeth() {
         }
     }
 }
-rmeth meth_for_char(std::string chars) {  // Reverse of char_for_meth
+rmeth meth_for_char(std::string_view chars) {  // Reverse of char_for_meth
     if (chars.length()==2) { return CMAP; }
-    return meth_for_most_char[chars[0]];
+    return meth_for_most_char[chars.empty() ? '\0' : chars[0]];
 }
@@ -12,16 +12,18 @@
 // This file holds the rmeth enum used to describe different types of data that could be read into a PstLine.
 
 #include <string>
+#include <string_view>
 
 
 enum rmeth : char           {TEXT, HEX, INT, BINARY, SHORT, CHAR, LCHAR, mFLOAT, uFLOAT, FMAP, SMAP, CMAP, BULK, ZERO, FEATURE };
 extern const int standard_rmeth_size[];
 extern const std::string char_for_meth[];
+extern const std::string name_for_meth[];   // The enum names, for reports.
 
 bool constexpr is_world_map(rmeth m) {      // world maps get special handling.
     return (m==SMAP || m==CMAP || m==FMAP);
 }
-rmeth meth_for_char(std::string chars);
+rmeth meth_for_char(std::string_view chars);
 void set_up_rmeth();
 
 #endif /* Pirates_hpp */
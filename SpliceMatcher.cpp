@@ -0,0 +1,75 @@
+//
+//  SpliceMatcher.cpp
+//  pirates_savegame_editor
+//
+// A splice used to be two std::regex per pattern (the line_code, and the line_code followed by _.*),
+// checked against every line of the section, once for each output file.
+// Since the sortcode holds the numbers of a line_code in fixed 3 digit groups, a pattern of numbers and x
+// becomes a range check on the groups before the first x, plus one division for each number after it.
+
+#include "SpliceMatcher.hpp"
+#include <algorithm>
+#include <regex>
+#include <string>
+#include <vector>
+using namespace std;
+
+constexpr int sortcode_groups = 6;
+
+static bool is_number(const string & piece) {
+    // Only the way numbers are written in a line_code. Anything else (like 05) keeps the regex, which would not match 5.
+    if (piece.length() == 0 || piece.length() > 3) return false;
+    if (piece.length() > 1 && piece[0] == '0') return false;
+    return all_of(piece.begin(), piece.end(), [](char c) { return c >= '0' && c <= '9'; });
+}
+
+SpliceMatcher::SpliceMatcher(const std::string & line_code) {
+    // Split _x_10 into x and 10.
+    vector<string> split;
+    bool simple = line_code.length() == 0 || line_code[0] == '_';
+    for (size_t start = 1; simple && start <= line_code.length(); ) {
+        size_t end = min(line_code.find('_', start), line_code.length());
+        split.push_back(line_code.substr(start, end-start));
+        start = end + 1;
+    }
+    for (auto && piece : split) {
+        if (piece != "x" && ! is_number(piece)) { simple = false; }
+    }
+    if (! simple || split.size() > sortcode_groups) {
+        use_regex = true;
+        string pattern = regex_replace(line_code, regex("_x"), "_\\d+");
+        exact = regex(pattern);
+        prefix = regex(pattern + "_.*");
+        return;
+    }
+
+    pieces = (int)split.size();
+    Sortcode group_size = 1;
+    for (int g=0; g<sortcode_groups; g++) { group_size *= 1000; }
+    low = group_size;   // The leading 1 of every sortcode
+    bool before_x = true;
+    for (auto && piece : split) {
+        group_size /= 1000;
+        if (piece == "x") {
+            before_x = false;
+        } else if (before_x) {
+            low += stoi(piece) * group_size;
+        } else {
+            checks.emplace_back(group_size, stoi(piece));
+        }
+        if (before_x) { high = low + group_size - 1; }
+    }
+    if (pieces == 0 || split[0] == "x") { high = low * 2 - 1; }
+}
+
+bool SpliceMatcher::matches(Sortcode sortcode, const std::string & line_code) const {
+    if (use_regex) {
+        return regex_match(line_code, exact) || regex_match(line_code, prefix);
+    }
+    if (sortcode < low || sortcode > high) return false;
+    for (auto && [divisor, value] : checks) {
+        if ((int)(sortcode / divisor % 1000) != value) return false;
+    }
+    // _5 and _5_0 have the same sortcode, so the line also needs at least as many pieces as the pattern.
+    return count(line_code.begin(), line_code.end(), '_') >= pieces;
+}
@@ -0,0 +1,35 @@
+//
+//  SpliceMatcher.hpp
+//  pirates_savegame_editor
+//
+
+#ifndef SpliceMatcher_hpp
+#define SpliceMatcher_hpp
+
+#include <string>
+#include <vector>
+#include <regex>
+#include "PstFile.hpp"
+
+// One -splice or -clone pattern, like Ship_0 or Log_x_10, for matching the lines of its section.
+// A pattern matches a line_code that is the same, or that continues with more _ pieces (so Ship_0 matches Ship_0_2_1),
+// and an x matches any number.
+// Patterns that are only numbers and x are checked against the sortcode with integer comparisons.
+// Anything else in a pattern is treated as a regular expression, as it always has been.
+class SpliceMatcher {
+public:
+    explicit SpliceMatcher(const std::string & line_code);   // The pattern after the section name: _x_10, or "" for the whole section.
+    bool matches(Sortcode sortcode, const std::string & line_code) const;
+
+private:
+    bool use_regex = false;
+    std::regex exact;
+    std::regex prefix;
+
+    int pieces = 0;                // Number of _ pieces in the pattern
+    Sortcode low = 0;              // The range of sortcodes that share the numbers before the first x
+    Sortcode high = 0;
+    std::vector<std::pair<Sortcode, int>> checks;   // Divisor and value of each number after the first x
+};
+
+#endif /* SpliceMatcher_hpp */
@@ -0,0 +1,113 @@
+//
+//  SweepCache.cpp
+//  pirates_savegame_editor
+//
+// The cache is a text file with one tab separated line per savegame:
+//     path  size  hash  build  PASS/FAIL
+// The hash is always checked, since the time stamp of a file is too coarse to trust: an in-place -set keeps
+// the size, and can land in the same second. Hashing takes about a millisecond, next to a whole round trip.
+
+#include "SweepCache.hpp"
+#include "FingerprintHash.hpp"
+#include "PgReader.hpp"
+#include "PstSection.hpp"
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <cstdio>
+#include "boost/filesystem.hpp"
+#if defined(__APPLE__)
+#include <mach-o/dyld.h>
+#include <climits>
+#endif
+using namespace std;
+
+static const string cache_header = "# pirates_savegame_editor sweep cache";
+
+static string executable_path() {
+#if defined(__APPLE__)
+    char path[PATH_MAX];
+    uint32_t size = sizeof(path);
+    if (_NSGetExecutablePath(path, &size) == 0) return path;
+#elif defined(__linux__)
+    if (boost::filesystem::exists("/proc/self/exe")) return boost::filesystem::read_symlink("/proc/self/exe").string();
+#endif
+    return "";
+}
+
+const std::string & build_id() {
+    // Any change to the decoder relinks the program, so its size and time stamp identify the build.
+    // That holds even when the file that holds this function was not recompiled.
+    static const string id = [] {
+        string plan;
+        for (auto && line : decode_plan) {
+            plan += line.line_code + char_for_meth[line.method] + to_string(line.bytes) + ",";
+        }
+        stringstream ss;
+        boost::system::error_code ec;
+        string program = executable_path();
+        uintmax_t size = program.empty() ? 0 : boost::filesystem::file_size(program, ec);
+        if (program.empty() || ec) {
+            ss << __DATE__ << " " << __TIME__;   // Not as good, but the plan hash still catches layout changes.
+        } else {
+            ss << size << "." << boost::filesystem::last_write_time(program, ec);
+        }
+        ss << " " << hex << fingerprint_hash((const unsigned char *)plan.data(), plan.size());
+        return ss.str();
+    }();
+    return id;
+}
+
+SweepCache::SweepCache(const std::string & cache_file) : filename(cache_file) {
+    ifstream in(filename);
+    string line;
+    while (getline(in, line)) {
+        if (line.length() == 0 || line[0] == '#') continue;
+        stringstream fields(line);
+        string path, size, hash, result;
+        Fingerprint f;
+        if (getline(fields, path, '\t') && getline(fields, size, '\t') &&
+            getline(fields, hash, '\t') && getline(fields, f.build, '\t') && getline(fields, result)) {
+            try {
+                f.size = stoull(size);
+                f.hash = stoull(hash, nullptr, 16);
+                f.passed = result == "PASS";
+                entries[path] = f;
+            } catch (exception &) {}   // A damaged line just means that file gets tested again.
+        }
+    }
+}
+
+bool SweepCache::lookup(const std::string & pg_file, bool & passed) {
+    auto found = entries.find(pg_file);
+    if (found == entries.end()) return false;
+    Fingerprint & f = found->second;
+    if (f.build != build_id() || f.size != boost::filesystem::file_size(pg_file)) return false;
+    PgInput input(pg_file);
+    if (f.hash != fingerprint_hash(input.data(), input.size())) return false;
+    passed = f.passed;
+    return true;
+}
+
+void SweepCache::record(const std::string & pg_file, bool passed) {
+    Fingerprint f;
+    PgInput input(pg_file);
+    f.size = input.size();
+    f.hash = fingerprint_hash(input.data(), input.size());
+    f.build = build_id();
+    f.passed = passed;
+    entries[pg_file] = f;
+}
+
+void SweepCache::save() const {
+    string temp_file = filename + ".tmp";
+    ofstream out(temp_file);
+    if (! out.is_open()) throw runtime_error("Failed to write to " + temp_file);
+    out << cache_header << "\n";
+    for (auto && [path, f] : entries) {
+        out << path << "\t" << f.size << "\t" << hex << f.hash << dec << "\t"
+            << f.build << "\t" << (f.passed ? "PASS" : "FAIL") << "\n";
+    }
+    out.close();
+    boost::filesystem::rename(temp_file, filename);
+}
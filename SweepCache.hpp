@@ -0,0 +1,38 @@
+//
+//  SweepCache.hpp
+//  pirates_savegame_editor
+//
+
+#ifndef SweepCache_hpp
+#define SweepCache_hpp
+
+#include <string>
+#include <map>
+#include <cstdint>
+
+// Remembers the result of -sweep for each savegame, so that later sweeps can skip the ones that have not changed.
+// A result only counts if the file has the same size and contents, and was tested by the same build,
+// since a change to the decoder can change the result.
+
+class SweepCache {
+public:
+    explicit SweepCache(const std::string & cache_file);
+    
+    bool lookup(const std::string & pg_file, bool & passed);   // True if pg_file was already tested, with the result in passed.
+    void record(const std::string & pg_file, bool passed);
+    void save() const;
+    
+private:
+    struct Fingerprint {
+        uint64_t size = 0;
+        uint64_t hash = 0;
+        std::string build;
+        bool passed = false;
+    };
+    std::string filename;
+    std::map<std::string, Fingerprint> entries;
+};
+
+const std::string & build_id();   // Changes whenever the program is linked again, and with any change to the decode plan.
+
+#endif /* SweepCache_hpp */
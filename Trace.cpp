@@ -0,0 +1,112 @@
+//
+//  Trace.cpp
+//  pirates_savegame_editor
+//
+// Each thread records its spans into its own buffer, so recording does not need a lock.
+// The buffers are owned here rather than by the threads, so they outlive the worker threads,
+// and are all written out together when the program exits.
+
+#include "Trace.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+using namespace std;
+
+bool tracing = false;
+
+namespace {
+struct TraceEvent {
+    const char * name;
+    string detail;
+    chrono::steady_clock::time_point start;
+    chrono::steady_clock::duration duration;
+};
+struct ThreadTrace {
+    int tid;
+    vector<TraceEvent> events;
+};
+}
+
+static string trace_file;
+static chrono::steady_clock::time_point trace_start;
+static mutex threads_mutex;
+static vector<unique_ptr<ThreadTrace>> thread_traces;
+
+static ThreadTrace & this_thread_trace() {
+    thread_local ThreadTrace * mine = nullptr;
+    if (! mine) {
+        lock_guard<mutex> lock(threads_mutex);
+        thread_traces.push_back(make_unique<ThreadTrace>());
+        mine = thread_traces.back().get();
+        mine->tid = (int)thread_traces.size();
+    }
+    return *mine;
+}
+
+void TraceSpan::begin(const char * n, std::string_view d) {
+    active = true;
+    name = n;
+    detail = d;
+    start = chrono::steady_clock::now();
+}
+
+void TraceSpan::end() {
+    auto stop = chrono::steady_clock::now();
+    this_thread_trace().events.push_back({name, std::move(detail), start, stop - start});
+}
+
+static string json_escape(const string & s) {
+    string escaped;
+    for (char c : s) {
+        if (c == '"' || c == '\\') { escaped += '\\'; escaped += c; }
+        else if ((unsigned char)c < 0x20) {
+            char buffer[8];
+            snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+            escaped += buffer;
+        }
+        else { escaped += c; }
+    }
+    return escaped;
+}
+
+static double micros(chrono::steady_clock::duration d) {
+    return chrono::duration<double, micro>(d).count();
+}
+
+static void write_trace() {
+    // Called at exit, after every worker thread has been joined.
+    ofstream out(trace_file);
+    if (! out.is_open()) {
+        cerr << "Failed to write to " << trace_file << "\n";
+        return;
+    }
+    char buffer[64];
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    bool first = true;
+    for (auto && thread : thread_traces) {
+        if (! first) { out << ",\n"; }
+        first = false;
+        out << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":" << thread->tid
+            << ",\"args\":{\"name\":\"" << (thread->tid == 1 ? "main" : "worker " + to_string(thread->tid)) << "\"}}";
+        for (auto && e : thread->events) {
+            snprintf(buffer, sizeof(buffer), ",\"ts\":%.3f,\"dur\":%.3f", micros(e.start - trace_start), micros(e.duration));
+            out << ",\n{\"ph\":\"X\",\"name\":\"" << json_escape(e.name) << "\",\"pid\":1,\"tid\":" << thread->tid << buffer;
+            if (e.detail.length() > 0) { out << ",\"args\":{\"detail\":\"" << json_escape(e.detail) << "\"}"; }
+            out << "}";
+        }
+    }
+    out << "\n]}\n";
+}
+
+void start_trace(const std::string & file) {
+    trace_file = file;
+    trace_start = chrono::steady_clock::now();
+    this_thread_trace();   // So the main thread is tid 1.
+    tracing = true;
+    atexit(write_trace);
+}
@@ -0,0 +1,39 @@
+//
+//  Trace.hpp
+//  pirates_savegame_editor
+//
+
+#ifndef Trace_hpp
+#define Trace_hpp
+
+#include <chrono>
+#include <string>
+#include <string_view>
+
+// Timing spans for -trace, written out as a Chrome trace event file
+// (open it in chrome://tracing or ui.perfetto.dev to see each thread's timeline).
+// A TraceSpan covers the time from its construction to its destruction, so spans nest with the code.
+// Without -trace, a TraceSpan only checks one flag.
+
+extern bool tracing;
+
+class TraceSpan {
+public:
+    // name must outlive the trace (a literal, or a section name). detail is copied, and shows up in the args.
+    explicit TraceSpan(const char * name, std::string_view detail = {}) { if (tracing) { begin(name, detail); } }
+    ~TraceSpan() { if (active) { end(); } }
+    TraceSpan(const TraceSpan &) = delete;
+    TraceSpan & operator=(const TraceSpan &) = delete;
+
+private:
+    void begin(const char * name, std::string_view detail);
+    void end();
+    bool active = false;
+    const char * name = nullptr;
+    std::string detail;
+    std::chrono::steady_clock::time_point start;
+};
+
+void start_trace(const std::string & trace_file);   // Turns on tracing. The file is written at exit.
+
+#endif /* Trace_hpp */
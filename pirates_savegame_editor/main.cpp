@@ -12,6 +12,10 @@
 #include <regex>
 #include <cstdio>
 #include "PiratesFiles.hpp"
+#include "Benchmark.hpp"
+#include "PstStats.hpp"
+#include "Trace.hpp"
+#include "AllocCounter.hpp"
 #include "PGetoptLong.hpp"
 
 // This file handles processing the input switches.
@@ -19,33 +23,55 @@
 using namespace std;
 
 string save_dir;  // global var to avoid passing it to every read/write routine in PiratesFiles.
+int thread_count = 1;  // Same reason.
+bool collect_stats = false;  // And again.
 
 int main(int argc, char **argv)
 {
     auto opt = PGetOptions(argc, argv, {
         "advanced_help",
         "auto",
+        "benchmark=s",
         "clone=s",
         "dir=s",
         "donor=s",
+        "fuzz=i",
+        "generate=s",
+        "get=s",
         "in=s",
+        "iterations=i",
         "not=s",
         "out=s",
         "pack=s",
+        "seed=i",
         "set=s",
         "splice=s",
+        "stats",
         "sweep",
         "test=s",
+        "threads=i",
+        "trace=s",
         "unpack=s"
     });
     
     // Get the pirates module ready to go.
-    set_up_decoding();
+    {
+        AllocScope scope(PHASE_SETUP);
+        set_up_decoding();
+    }
     
     // Setting the default pirates savegame dir.
     string env_user = "USER_NOT_DEFINED";
     if(const char* env_p = std::getenv("USER")) { env_user = env_p; }
     save_dir = "/Users/" + env_user + "/Library/Preferences/Firaxis Games/Sid Meier's Pirates!/My Games/Game";
+    if (opt.count("dir")) { save_dir = opt["dir"]; }
+    
+    if (opt.count("threads")) { thread_count = max(1, stoi(opt["threads"])); }
+    if (opt.count("stats")) {
+        collect_stats = true;
+        atexit(report_allocations);   // Only does anything in a build with PIRATES_COUNT_ALLOCATIONS.
+    }
+    if (opt.count("trace")) { start_trace(opt["trace"]); }
     
    
     if (opt.count("auto") && opt.count("splice")) throw invalid_argument("Do not combine -splice and -auto");
@@ -60,11 +86,13 @@ int main(int argc, char **argv)
         for (auto afile : list) {
             unpack(afile);  // takes a short filename.
         }
+        if (collect_stats) { report_stats_summary(); }
     } else if (opt.count("pack")) {
         auto list = split_by_commas(opt["pack"]);
         for (auto afile : list) {
             pack(afile);
         }
+        if (collect_stats) { report_stats_summary(); }
     } else if (opt.count("test") || opt.count("sweep")) {
         vector<std::string> list;
         if (opt.count("sweep")) {
@@ -74,11 +102,15 @@ int main(int argc, char **argv)
             auto tlist = split_by_commas(opt["test"]);
             list.insert(list.end(), tlist.begin(), tlist.end());
         }
-        for (auto afile : list) {
-            unpack(afile);
-            testpack(afile);
-            comparePg(afile);
-        }
+        int failures = test_files(list, opt.count("sweep"));
+        if (collect_stats) { report_stats_summary(); }
+        if (failures > 0) { exit(1); }
+    } else if (opt.count("generate")) {
+        generate(opt["generate"], opt.count("seed") ? stoull(opt["seed"]) : 1);
+    } else if (opt.count("fuzz")) {
+        if (fuzz(stol(opt["fuzz"]), opt.count("seed") ? stoull(opt["seed"]) : 1) > 0) { exit(1); }
+    } else if (opt.count("benchmark")) {
+        run_benchmarks(opt["benchmark"], opt.count("iterations") ? stoi(opt["iterations"]) : 5);
     } else if (opt.count("in") && opt.count("out") && opt.count("splice")) {
         if (opt.count("donor") && opt.count("set"))   throw invalid_argument("Do not use -donor and -set together");
         if (opt.count("donor") && opt.count("clone")) throw invalid_argument("Do not use -donor and -clone together");
@@ -86,6 +118,10 @@ int main(int argc, char **argv)
         splice(opt["in"], opt["donor"], opt["out"], opt["splice"], opt["clone"], opt["set"], opt["not"]);
     } else if (opt.count("in") && opt.count("out") && opt.count("donor") && opt.count("auto")) {
         auto_splice(opt["in"], opt["donor"], opt["out"], opt["not"]);
+    } else if (opt.count("in") && opt.count("get")) {
+        get_values(opt["in"], opt["get"]);
+    } else if (opt.count("in") && opt.count("set") && ! opt.count("out")) {
+        set_values(opt["in"], opt["set"]);
     } else {
         cout << "Unrecognized combination of options.\n";
     }
@@ -27,12 +27,8 @@ const std::vector<std::string> shipname_type_by_class = {
     "WARSHIPS",       "WARSHIPS",       "MERCHANT SHIPS"
 };
 
-string last_flag = "";
-void save_last_flag(string flag) { last_flag = flag;   }
-
-int last_shiptype = 0;
-string save_last_shiptype(const PstLine & i) {
-    last_shiptype = stoi(i.value);
+string save_last_shiptype(const PstLine & i, DecodeContext & ctx) {
+    ctx.last_shiptype = stoi(i.value);
     return "";
 }
 
@@ -694,13 +690,13 @@ void load_pirate_shipnames() {
     }
 }
 
-string translate_shipname(const PstLine & i) {
-    if (last_flag == "") { return "NIL"; }
-    if (last_shiptype < 0 ) { return "NIL"; }
+string translate_shipname(const PstLine & i, DecodeContext & ctx) {
+    if (ctx.last_flag == "") { return "NIL"; }
+    if (ctx.last_shiptype < 0 ) { return "NIL"; }
 
     // Assemble the shipname_group a combination of the flag and shipname_group
     // to know which list of shipnames to use - merchant, warship, or pirate.
-    string shipname_group = last_flag + " " + shipname_type_by_class.at(last_shiptype);
+    string shipname_group = ctx.last_flag + " " + shipname_type_by_class.at(ctx.last_shiptype);
     std::transform(shipname_group.begin(), shipname_group.end(),shipname_group.begin(), ::toupper);
     
     // All pirate ships get English Pirate shipnames, and all Indian ships get Spanish names.
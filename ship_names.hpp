@@ -13,8 +13,7 @@
 #include "PstLine.hpp"
 
 void load_pirate_shipnames();
-void save_last_flag(std::string);
-std::string save_last_shiptype(const PstLine &);
-std::string translate_shipname(const PstLine &);
+std::string save_last_shiptype(const PstLine &, DecodeContext &);
+std::string translate_shipname(const PstLine &, DecodeContext &);
 
 #endif /* ship_names_hpp */